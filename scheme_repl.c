@@ -2,11 +2,91 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <time.h>
+#include <setjmp.h>
+#include <alloca.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
-typedef enum { VAR, LAMBDA, APPLY, INT_LITERAL, ADD, MULTIPLY, QUOTE, DEFINE } ExprType;
+unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+unsigned long long cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// USDT probes (provider "scheme") for SystemTap, bpftrace and perf. They
+// compile to a single nop per site and cost nothing until a tracer attaches.
+// Build with -DNO_PROBES to leave them out entirely.
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SCHEME_PROBES 1
+#endif
+#endif
+
+#ifdef SCHEME_PROBES
+#define PROBE0(name) DTRACE_PROBE(scheme, name)
+#define PROBE1(name, a) DTRACE_PROBE1(scheme, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(scheme, name, a, b)
+#else
+#define PROBE0(name) do { } while (0)
+#define PROBE1(name, a) do { } while (0)
+#define PROBE2(name, a, b) do { } while (0)
+#endif
+
+#ifdef PROFILE_EVAL
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define profile_clock() __rdtsc()
+#else
+#define profile_clock() now_ns()
+#endif
+#endif
+
+typedef enum { VAR, LAMBDA, APPLY, INT_LITERAL, ADD, MULTIPLY, QUOTE, DEFINE, TIME, CLOSURE, THUNK,
+               NORMALIZE, EQ, DELAY, DELAY_FORCE, FORCE, PROMISE, CONS, CAR, CDR, PAIR, NIL,
+               STREAM_ITERATE, STREAM_REF, STREAM_TAKE, MEMOIZE, MEMO,
+               REF, ADAPT, GET, SET_REF, ADAPTON, GLOBAL_REF,
+               CALLCC, CALL1CC, CONTINUATION, TRACE_ANCHOR, LIFTED_CALL, FLOAT_LITERAL,
+               SUBTRACT, LESS, NUM_EQUAL, IF, BRANCHES, BOOLEAN,
+               ADD_VAR_VAR, ADD_VAR_INT, MUL_VAR_VAR, MUL_VAR_INT, APPLY_GLOBAL_VAR,
+               IF_LESS, IF_NUM_EQUAL } ExprType;
+
+#define EXPR_TYPE_COUNT (IF_NUM_EQUAL + 1)  // Keep in sync with the last ExprType
+
+struct Environment;
+struct MemoCache;
+struct AdaptNode;
+struct Continuation;
+struct Trace;
+struct Lifted;
+
+// SRFI-45 promise state, shared between promises chained by delay-force
+typedef struct PromiseBox {
+    enum { PROMISE_DONE, PROMISE_DELAY, PROMISE_LAZY, PROMISE_ITERATE } state;
+    struct Expr *expr;  // Value when done, body when delayed, generator function when iterating
+    struct Environment *env;
+    struct Expr *seed;  // Next element of an iterated stream
+} PromiseBox;
 
 typedef struct Expr {
     ExprType type;
+    int site;  // Profile slot of an if or lambda (see pgo_sites), 0 for none
     union {
         char *var;  // Variable
         struct {
@@ -17,11 +97,27 @@ typedef struct Expr {
             struct Expr *func;
             struct Expr *arg;
         } apply;  // Application
-        int int_value;  // Integer literal
+        int int_value;  // Integer literal, or 1 for #t and 0 for #f
+        double float_value;  // Floating-point literal
         struct {
             struct Expr *left;
             struct Expr *right;
-        } binop;  // Binary operation (add/multiply)
+        } binop;  // Binary operation (add/multiply), if: test and branches, branches: then and else
+        struct {
+            struct Expr *lambda;
+            struct Environment *env;
+        } closure;  // Lambda value with its defining environment
+        struct {
+            struct Expr *expr;  // NULL while being forced
+            struct Environment *env;
+        } thunk;  // Suspended argument (lazy mode), overwritten by its value
+        PromiseBox *promise;  // delay, delay-force, stream-iterate
+        struct MemoCache *memo;  // Memoized procedure
+        struct AdaptNode *adapton;  // Incremental reference or thunk
+        struct Environment *global;  // Binding of a global referenced by compiled code
+        struct Continuation *continuation;  // Captured by call/cc or call/1cc
+        struct Trace *trace;  // JIT state in front of a compiled lambda body
+        struct Lifted *lifted;  // Direct call of a lambda-lifted function
     } data;
 } Expr;
 
@@ -31,23 +127,36 @@ typedef struct Environment {
     struct Environment *next;
 } Environment;
 
+// Allocation accounting for interpreter objects (nothing is freed yet)
+static unsigned long long alloc_count;
+static unsigned long long alloc_bytes;
+
+void *scheme_alloc(size_t size) {
+    alloc_count++;
+    alloc_bytes += size;
+    void *object = malloc(size);
+    PROBE2(alloc, object, size);
+    return object;
+}
+
 Expr *make_var(char *var) {
-    Expr *expr = malloc(sizeof(Expr));
+    Expr *expr = scheme_alloc(sizeof(Expr));
     expr->type = VAR;
     expr->data.var = strdup(var);
     return expr;
 }
 
 Expr *make_lambda(char *param, Expr *body) {
-    Expr *expr = malloc(sizeof(Expr));
+    Expr *expr = scheme_alloc(sizeof(Expr));
     expr->type = LAMBDA;
+    expr->site = 0;
     expr->data.lambda.param = strdup(param);
     expr->data.lambda.body = body;
     return expr;
 }
 
 Expr *make_apply(Expr *func, Expr *arg) {
-    Expr *expr = malloc(sizeof(Expr));
+    Expr *expr = scheme_alloc(sizeof(Expr));
     expr->type = APPLY;
     expr->data.apply.func = func;
     expr->data.apply.arg = arg;
@@ -55,22 +164,335 @@ Expr *make_apply(Expr *func, Expr *arg) {
 }
 
 Expr *make_int(int value) {
-    Expr *expr = malloc(sizeof(Expr));
+    Expr *expr = scheme_alloc(sizeof(Expr));
     expr->type = INT_LITERAL;
     expr->data.int_value = value;
     return expr;
 }
 
+Expr *make_float(double value) {
+    Expr *expr = scheme_alloc(sizeof(Expr));
+    expr->type = FLOAT_LITERAL;
+    expr->data.float_value = value;
+    return expr;
+}
+
 Expr *make_binop(ExprType type, Expr *left, Expr *right) {
-    Expr *expr = malloc(sizeof(Expr));
+    Expr *expr = scheme_alloc(sizeof(Expr));
     expr->type = type;
+    expr->site = 0;
     expr->data.binop.left = left;
     expr->data.binop.right = right;
     return expr;
 }
 
+// An if has three operands: the two branches share a BRANCHES node
+Expr *make_if(Expr *test, Expr *then, Expr *otherwise) {
+    return make_binop(IF, test, make_binop(BRANCHES, then, otherwise));
+}
+
+// Integers are fixnums without promotion: 1 if a + b, a - b or a * b does not fit
+int int_overflows(ExprType type, int a, int b, int *result) {
+    switch (type) {
+        case ADD:
+            return __builtin_add_overflow(a, b, result);
+        case SUBTRACT:
+            return __builtin_sub_overflow(a, b, result);
+        default:
+            return __builtin_mul_overflow(a, b, result);
+    }
+}
+
+// Numbers in flight are NaN-boxed words. A double is stored as itself, with
+// any NaN canonicalized to the positive quiet NaN, and an int sits in the low
+// half of a negative quiet NaN that arithmetic never produces. Nested + and *
+// hand these words to each other and only the outermost result is boxed, so
+// (+ (* a b) (* c d)) allocates once rather than three times. That is as far
+// as it goes in the interpreter: its values are Expr pointers, not these
+// words, so every number that is bound, returned or stored is a heap Expr
+// made by number_box. A float loop allocates its float arguments on every
+// iteration, just as an int loop does in the interpreter, until it is traced:
+// traces keep ints and doubles unboxed in registers. Only programs compiled
+// with --compile-to-c keep doubles in the value word.
+typedef uint64_t Number;
+#define NUMBER_INT 0xfff9000000000000ULL   // Tag of an int
+#define NUMBER_NONE 0xfffa000000000000ULL  // Not a number
+#define NUMBER_NAN 0x7ff8000000000000ULL
+
+Number number_int(int value) {
+    return NUMBER_INT | (uint32_t)value;
+}
+
+Number number_double(double value) {
+    Number n;
+    if (value != value) return NUMBER_NAN;
+    memcpy(&n, &value, sizeof(n));
+    return n;
+}
+
+int number_is_int(Number n) {
+    return (n >> 48) == (NUMBER_INT >> 48);
+}
+
+double number_to_double(Number n) {
+    if (number_is_int(n)) return (int32_t)n;
+    double value;
+    memcpy(&value, &n, sizeof(value));
+    return value;
+}
+
+Number number_of(Expr *value) {
+    if (value->type == INT_LITERAL) return number_int(value->data.int_value);
+    if (value->type == FLOAT_LITERAL) return number_double(value->data.float_value);
+    return NUMBER_NONE;
+}
+
+Expr *number_box(Number n) {
+    return number_is_int(n) ? make_int((int32_t)n) : make_float(number_to_double(n));
+}
+
+// a + b, a - b or a * b, with an int promoted to double when the other
+// operand is one; 0 if an operand is not a number or an int result overflows
+int number_arith(ExprType type, Number a, Number b, Number *result) {
+    if (a == NUMBER_NONE || b == NUMBER_NONE) return 0;
+    if (number_is_int(a) && number_is_int(b)) {
+        int value;
+        if (int_overflows(type, (int32_t)a, (int32_t)b, &value)) return 0;
+        *result = number_int(value);
+        return 1;
+    }
+    double x = number_to_double(a), y = number_to_double(b);
+    *result = number_double(type == ADD ? x + y : type == SUBTRACT ? x - y : x * y);
+    return 1;
+}
+
+// a < b or a = b for numbers, promoting like number_arith
+int number_compare(ExprType type, Number a, Number b) {
+    if (number_is_int(a) && number_is_int(b)) {
+        return type == LESS ? (int32_t)a < (int32_t)b : (int32_t)a == (int32_t)b;
+    }
+    double x = number_to_double(a), y = number_to_double(b);
+    return type == LESS ? x < y : x == y;
+}
+
+// Shortest form that reads back as the same double, always with a point or
+// exponent so that it reads back as a float
+void format_double(char *buf, size_t size, double value) {
+    if (value != value) {
+        snprintf(buf, size, "+nan.0");
+        return;
+    }
+    if (value == 1.0 / 0.0 || value == -1.0 / 0.0) {
+        snprintf(buf, size, "%cinf.0", value > 0 ? '+' : '-');
+        return;
+    }
+    for (int precision = 1; precision <= 17; precision++) {
+        snprintf(buf, size, "%.*g", precision, value);
+        if (strtod(buf, NULL) == value) break;
+    }
+    if (strpbrk(buf, ".e") == NULL) strncat(buf, ".0", size - strlen(buf) - 1);
+}
+
+#ifdef PROFILE_EVAL
+// Profiling build (-DPROFILE_EVAL): per-node-type counters and cycle histograms
+#define PROFILE_BUCKETS 48
+#define PROFILE_MAX_DEPTH 32
+
+static const char *expr_type_names[] = {
+    "VAR", "LAMBDA", "APPLY", "INT_LITERAL", "ADD", "MULTIPLY", "QUOTE", "DEFINE", "TIME",
+    "CLOSURE", "THUNK", "NORMALIZE", "EQ", "DELAY", "DELAY_FORCE", "FORCE", "PROMISE",
+    "CONS", "CAR", "CDR", "PAIR", "NIL", "STREAM_ITERATE", "STREAM_REF", "STREAM_TAKE",
+    "MEMOIZE", "MEMO", "REF", "ADAPT", "GET", "SET_REF", "ADAPTON",
+    "GLOBAL_REF", "CALLCC", "CALL1CC", "CONTINUATION", "TRACE_ANCHOR", "LIFTED_CALL", "FLOAT_LITERAL",
+    "SUBTRACT", "LESS", "NUM_EQUAL", "IF", "BRANCHES", "BOOLEAN",
+    "ADD_VAR_VAR", "ADD_VAR_INT", "MUL_VAR_VAR", "MUL_VAR_INT", "APPLY_GLOBAL_VAR",
+    "IF_LESS", "IF_NUM_EQUAL"
+};
+
+typedef struct {
+    unsigned long long count;
+    unsigned long long total_cycles;  // Including nested evals
+    unsigned long long self_cycles;   // Excluding nested evals
+    unsigned long long histogram[PROFILE_BUCKETS];  // Self cycles, log2 buckets
+} NodeProfile;
+
+static NodeProfile node_profile[EXPR_TYPE_COUNT];
+static unsigned long long nested_cycles;  // Cycles spent in children of the current eval
+static unsigned long long lookup_depth[PROFILE_MAX_DEPTH + 1];  // Last bucket collects deeper lookups
+static unsigned long long lookup_misses;
+// Dispatch sequences: consecutive node types entering eval, for choosing superinstructions
+static unsigned long long step_pairs[EXPR_TYPE_COUNT][EXPR_TYPE_COUNT];
+static unsigned long long step_triples[EXPR_TYPE_COUNT][EXPR_TYPE_COUNT][EXPR_TYPE_COUNT];
+static int last_steps[2] = { -1, -1 };
+
+void profile_record_step(ExprType type) {
+    if (last_steps[1] >= 0) step_pairs[last_steps[1]][type]++;
+    if (last_steps[0] >= 0) step_triples[last_steps[0]][last_steps[1]][type]++;
+    last_steps[0] = last_steps[1];
+    last_steps[1] = type;
+}
+
+void profile_record(ExprType type, unsigned long long total, unsigned long long self) {
+    NodeProfile *p = &node_profile[type];
+    int bucket = 0;
+    while (bucket < PROFILE_BUCKETS - 1 && (self >> (bucket + 1)) != 0) bucket++;
+    p->count++;
+    p->total_cycles += total;
+    p->self_cycles += self;
+    p->histogram[bucket]++;
+}
+
+void profile_record_lookup(int depth, int found) {
+    if (!found) lookup_misses++;
+    lookup_depth[depth < PROFILE_MAX_DEPTH ? depth : PROFILE_MAX_DEPTH]++;
+}
+
+void profile_report(void) {
+    fprintf(stderr, "\n%-12s %12s %16s %16s %10s\n", "node", "count", "total cycles", "self cycles", "self/node");
+    for (int t = 0; t < EXPR_TYPE_COUNT; t++) {
+        NodeProfile *p = &node_profile[t];
+        if (p->count == 0) continue;
+        fprintf(stderr, "%-12s %12llu %16llu %16llu %10llu\n", expr_type_names[t],
+                p->count, p->total_cycles, p->self_cycles, p->self_cycles / p->count);
+    }
+    for (int t = 0; t < EXPR_TYPE_COUNT; t++) {
+        NodeProfile *p = &node_profile[t];
+        if (p->count == 0) continue;
+        fprintf(stderr, "\n%s self-cycle histogram:\n", expr_type_names[t]);
+        for (int b = 0; b < PROFILE_BUCKETS; b++) {
+            if (p->histogram[b] == 0) continue;
+            fprintf(stderr, "  [%llu, %llu) %llu\n", b == 0 ? 0ULL : 1ULL << b, 1ULL << (b + 1), p->histogram[b]);
+        }
+    }
+    fprintf(stderr, "\nmost frequent dispatch pairs and triples:\n");
+    for (int length = 2; length <= 3; length++) {
+        unsigned long long *counts = length == 2 ? &step_pairs[0][0] : &step_triples[0][0][0];
+        int cells = length == 2 ? EXPR_TYPE_COUNT * EXPR_TYPE_COUNT : EXPR_TYPE_COUNT * EXPR_TYPE_COUNT * EXPR_TYPE_COUNT;
+        int top[10], shown = 0;
+        for (int i = 0; i < cells; i++) {  // Insertion into a top-ten list
+            if (counts[i] == 0) continue;
+            int j = shown < 10 ? shown++ : 10;
+            for (; j > 0 && counts[top[j - 1]] < counts[i]; j--) {
+                if (j < 10) top[j] = top[j - 1];
+            }
+            if (j < 10) top[j] = i;
+        }
+        for (int r = 0; r < shown; r++) {
+            fprintf(stderr, "  %12llu ", counts[top[r]]);
+            if (length == 3) fprintf(stderr, "%s ", expr_type_names[top[r] / (EXPR_TYPE_COUNT * EXPR_TYPE_COUNT)]);
+            fprintf(stderr, "%s %s\n", expr_type_names[top[r] / EXPR_TYPE_COUNT % EXPR_TYPE_COUNT],
+                    expr_type_names[top[r] % EXPR_TYPE_COUNT]);
+        }
+    }
+    fprintf(stderr, "\nenv_lookup search depth (%llu misses):\n", lookup_misses);
+    for (int d = 0; d <= PROFILE_MAX_DEPTH; d++) {
+        if (lookup_depth[d] == 0) continue;
+        fprintf(stderr, "  %s%d %llu\n", d == PROFILE_MAX_DEPTH ? ">=" : "", d, lookup_depth[d]);
+    }
+}
+#endif
+
+Expr *make_unary(ExprType type, Expr *arg) {
+    Expr *expr = scheme_alloc(sizeof(Expr));
+    expr->type = type;
+    expr->data.apply.arg = arg;
+    return expr;
+}
+
+Expr *make_promise(int state, Expr *body, struct Environment *env) {
+    PromiseBox *box = scheme_alloc(sizeof(PromiseBox));
+    box->state = state;
+    box->expr = body;
+    box->env = env;
+    box->seed = NULL;
+    Expr *expr = scheme_alloc(sizeof(Expr));
+    expr->type = PROMISE;
+    expr->data.promise = box;
+    return expr;
+}
+
+Expr *make_closure(Expr *lambda, struct Environment *env) {
+    Expr *expr = scheme_alloc(sizeof(Expr));
+    expr->type = CLOSURE;
+    expr->data.closure.lambda = lambda;
+    expr->data.closure.env = env;
+    return expr;
+}
+
+// Special forms whose operands are all expressions: one operand is stored in
+// data.apply.arg, two in data.binop
+typedef struct {
+    const char *name;
+    ExprType type;
+    int arity;
+} SpecialForm;
+
+static const SpecialForm special_forms[] = {
+    { "+", ADD, 2 },
+    { "*", MULTIPLY, 2 },
+    { "-", SUBTRACT, 2 },
+    { "<", LESS, 2 },
+    { "=", NUM_EQUAL, 2 },
+    { "quote", QUOTE, 1 },
+    { "time", TIME, 1 },
+    { "normalize", NORMALIZE, 1 },
+    { "eq", EQ, 2 },
+    { "delay", DELAY, 1 },
+    { "delay-force", DELAY_FORCE, 1 },
+    { "force", FORCE, 1 },
+    { "cons", CONS, 2 },
+    { "car", CAR, 1 },
+    { "cdr", CDR, 1 },
+    { "stream-iterate", STREAM_ITERATE, 2 },
+    { "stream-ref", STREAM_REF, 2 },
+    { "stream-take", STREAM_TAKE, 2 },
+    { "memoize", MEMOIZE, 1 },
+    { "ref", REF, 1 },
+    { "adapt", ADAPT, 1 },
+    { "get", GET, 1 },
+    { "set-ref!", SET_REF, 2 },
+    { "call/cc", CALLCC, 1 },
+    { "call/1cc", CALL1CC, 1 },
+};
+
+#define SPECIAL_FORM_COUNT (sizeof(special_forms) / sizeof(special_forms[0]))
+
+const SpecialForm *find_special_form(const char *name) {
+    for (size_t i = 0; i < SPECIAL_FORM_COUNT; i++) {
+        if (strcmp(special_forms[i].name, name) == 0) return &special_forms[i];
+    }
+    return NULL;
+}
+
+const SpecialForm *special_form_of(ExprType type) {
+    for (size_t i = 0; i < SPECIAL_FORM_COUNT; i++) {
+        if (special_forms[i].type == type) return &special_forms[i];
+    }
+    return NULL;
+}
+
+// A superinstruction keeps the layout of the node it fuses, so everything
+// but eval can treat it as that node
+ExprType base_type(ExprType type) {
+    switch (type) {
+        case ADD_VAR_VAR:
+        case ADD_VAR_INT:
+            return ADD;
+        case MUL_VAR_VAR:
+        case MUL_VAR_INT:
+            return MULTIPLY;
+        case APPLY_GLOBAL_VAR:
+            return APPLY;
+        case IF_LESS:
+        case IF_NUM_EQUAL:
+            return IF;
+        default:
+            return type;
+    }
+}
+
 Environment *env_create(char *var, Expr *value, Environment *next) {
-    Environment *env = malloc(sizeof(Environment));
+    Environment *env = scheme_alloc(sizeof(Environment));
     env->var = strdup(var);
     env->value = value;
     env->next = next;
@@ -78,174 +500,5530 @@ Environment *env_create(char *var, Expr *value, Environment *next) {
 }
 
 Expr *env_lookup(Environment *env, char *var) {
+#ifdef PROFILE_EVAL
+    int depth = 0;
+#endif
     while (env != NULL) {
         if (strcmp(env->var, var) == 0) {
+#ifdef PROFILE_EVAL
+            profile_record_lookup(depth, 1);
+#endif
             return env->value;
         }
         env = env->next;
+#ifdef PROFILE_EVAL
+        depth++;
+#endif
     }
+#ifdef PROFILE_EVAL
+    profile_record_lookup(depth, 0);
+#endif
     return NULL;  // Variable not found
 }
 
-Expr *eval(Expr *expr, Environment *env) {
+static Environment *global_env;  // Top-level DEFINEs, searched after the local environment
+static int lazy_mode;  // --lazy: call-by-need application
+
+Expr *env_resolve(Environment *env, char *var) {
+    Expr *value = env_lookup(env, var);
+    return value != NULL ? value : env_lookup(global_env, var);
+}
+
+Expr *eval(Expr *expr, Environment *env);
+Expr *nbe_normalize(Expr *term);
+
+// Non-local exits. Runtime errors longjmp to a handler that the REPL and
+// bench loops install once, so evaluation that succeeds pays nothing for
+// them. The dynamic state eval keeps in globals is recorded by each handler
+// and continuation and put back before jumping, while the abandoned frames
+// are still live.
+typedef struct Forcing {  // A thunk under evaluation, black-holed meanwhile
+    Expr *thunk;
+    Expr *expr;
+    struct Environment *env;
+    struct Forcing *outer;
+} Forcing;
+
+static Forcing *forcing;
+static struct AdaptNode *adapt_current;  // Thunk being computed, NULL at top level
+static struct Continuation *continuations;  // Innermost call/cc still running
+static struct PgoCounts *pgo_current;  // Counters of the running top-level lambda
+
+typedef struct {
+    Forcing *forcing;
+    struct Continuation *continuations;
+    struct AdaptNode *adapt_current;
+    struct PgoCounts *pgo_current;
+#ifdef PROFILE_EVAL
+    unsigned long long nested_cycles;  // The profiler's, so abandoned evals do not skew it
+    int last_steps[2];
+#endif
+} DynamicState;
+
+void dynamic_save(DynamicState *state) {
+    state->forcing = forcing;
+    state->continuations = continuations;
+    state->adapt_current = adapt_current;
+    state->pgo_current = pgo_current;
+#ifdef PROFILE_EVAL
+    state->nested_cycles = nested_cycles;
+    state->last_steps[0] = last_steps[0];
+    state->last_steps[1] = last_steps[1];
+#endif
+}
+
+// First-class continuations (call/cc, call/1cc). The evaluator keeps its
+// control stack on the C stack, so a continuation is captured in O(1) with
+// setjmp, and while its call/cc is still running invoking it unwinds straight
+// back there with longjmp. A call/1cc continuation is one-shot: returning
+// from the call/1cc uses it up, so that is all it ever costs, and invoking it
+// afterwards is an error. A call/cc continuation can be re-entered after its
+// call/cc returned, any number of times: the call/cc, as it returns, copies
+// the frames it returns into, down to the loop reading forms, to the heap, and
+// invoking the continuation later copies them back over the stack and jumps
+// into them. Re-entering a form that has finished runs it to the end again,
+// after which the loop reads on from where the input is now. The copy is
+// O(frames) once per call/cc return; generators and early exits that never
+// re-enter a returned call/cc are cheaper written with call/1cc.
+typedef struct Continuation {
+    jmp_buf target;
+    int active;    // The capturing call/cc has not returned yet
+    int one_shot;  // Captured by call/1cc
+    Expr *value;
+    DynamicState state;  // As of the call/cc, before this continuation
+    char *frames;        // Copy of the stack from low up to continuation_base, once the call/cc returned
+    char *low;
+    struct Continuation *outer;
+} Continuation;
+
+static char *continuation_base;  // Frame of the loop reading forms: the bottom of a saved continuation
+
+// Restore thunks left black-holed, retire continuations whose call/cc is
+// being exited, leave any Adapton computation being abandoned and rewind the
+// profiler past the evals that will never return to record themselves
+void dynamic_unwind(DynamicState *state) {
+    for (; forcing != state->forcing; forcing = forcing->outer) forcing->thunk->data.thunk.expr = forcing->expr;
+    for (; continuations != state->continuations; continuations = continuations->outer) continuations->active = 0;
+    adapt_current = state->adapt_current;
+    pgo_current = state->pgo_current;
+#ifdef PROFILE_EVAL
+    nested_cycles = state->nested_cycles;
+    last_steps[0] = state->last_steps[0];
+    last_steps[1] = state->last_steps[1];
+#endif
+}
+
+// The reverse, from the top level, for frames just copied back onto the
+// stack: their thunks are black-holed again and their continuations escapes
+void dynamic_rewind(DynamicState *state) {
+    for (Forcing *frame = state->forcing; frame != NULL; frame = frame->outer) {
+        frame->thunk->type = THUNK;
+        frame->thunk->data.thunk.expr = NULL;
+        frame->thunk->data.thunk.env = frame->env;
+    }
+    for (Continuation *k = state->continuations; k != NULL; k = k->outer) k->active = 1;
+    forcing = state->forcing;
+    continuations = state->continuations;
+    adapt_current = state->adapt_current;
+    pgo_current = state->pgo_current;
+#ifdef PROFILE_EVAL
+    nested_cycles = state->nested_cycles;
+    last_steps[0] = state->last_steps[0];
+    last_steps[1] = state->last_steps[1];
+#endif
+}
+
+// A signalled runtime error: kind classifies it, message is what gets reported
+typedef struct {
+    const char *kind;
+    char message[256];
+} Condition;
+
+typedef struct {
+    jmp_buf target;
+    DynamicState state;
+    Condition condition;
+} ErrorHandler;
+
+static ErrorHandler *error_handler;  // NULL outside the REPL: errors exit
+unsigned long long errors_signalled;
+
+__attribute__((noreturn)) void scheme_error(const char *kind, const char *format, ...) {
+    errors_signalled++;
+    va_list args;
+    va_start(args, format);
+    if (error_handler == NULL) {
+        vfprintf(stderr, format, args);
+        fprintf(stderr, "\n");
+        va_end(args);
+        exit(EXIT_FAILURE);
+    }
+    ErrorHandler *handler = error_handler;
+    handler->condition.kind = kind;
+    vsnprintf(handler->condition.message, sizeof(handler->condition.message), format, args);
+    va_end(args);
+    dynamic_unwind(&handler->state);
+    longjmp(handler->target, 1);
+}
+
+// The message, followed by its kind
+void report_condition(Condition *condition) {
+    fprintf(stderr, "%s [%s]\n", condition->message, condition->kind);
+}
+
+Expr *make_continuation(int one_shot) {
+    Continuation *k = scheme_alloc(sizeof(Continuation));
+    k->active = 1;
+    k->one_shot = one_shot;
+    k->value = NULL;
+    k->frames = NULL;
+    dynamic_save(&k->state);
+    k->outer = continuations;
+    continuations = k;
+    Expr *expr = scheme_alloc(sizeof(Expr));
+    expr->type = CONTINUATION;
+    expr->data.continuation = k;
+    return expr;
+}
+
+// Called by a returning call/cc, whose frame and those below it are as they
+// were when k was captured; this function's own frame starts the copy
+__attribute__((noinline)) void continuation_save(Continuation *k) {
+    k->low = __builtin_frame_address(0);
+    k->frames = scheme_alloc(continuation_base - k->low);
+    memcpy(k->frames, k->low, continuation_base - k->low);
+}
+
+__attribute__((noinline, noreturn)) void continuation_resume(Continuation *k) {
+    memcpy(k->low, k->frames, continuation_base - k->low);
+    dynamic_rewind(&k->state);
+    longjmp(k->target, 1);
+}
+
+__attribute__((noreturn)) void continuation_reenter(Continuation *k) {
+    // The saved frames may reach deeper than this one: move below them first
+    char *here = __builtin_frame_address(0);
+    volatile char *gap = alloca(here > k->low ? (size_t)(here - k->low) + 1024 : 1);
+    gap[0] = 0;
+    continuation_resume(k);
+}
+
+__attribute__((noreturn)) void continuation_throw(Continuation *k, Expr *value) {
+    k->value = value;
+    if (k->active) {
+        dynamic_unwind(&k->state);
+        longjmp(k->target, 1);
+    }
+    if (k->frames == NULL) scheme_error("continuation", "One-shot continuation invoked after its call/1cc returned");
+    dynamic_unwind(&error_handler->state);  // Out of the running form entirely
+    continuation_reenter(k);
+}
+
+// Evaluate a thunk at most once, then overwrite it with its value so that
+// every binding sharing it sees the result (graph reduction update)
+Expr *force(Expr *value) {
+    if (value->type != THUNK) return value;
+    Expr *expr = value->data.thunk.expr;
+    if (expr == NULL) scheme_error("cycle", "Infinite loop: value depends on itself");
+    Forcing frame = { value, expr, value->data.thunk.env, forcing };
+    forcing = &frame;
+    value->data.thunk.expr = NULL;  // Black hole until the value is known
+    Expr *result = eval(expr, value->data.thunk.env);
+    forcing = frame.outer;
+    *value = *result;
+    return value;
+}
+
+// Call-by-need argument: atoms and lambdas are values already, and variables
+// pass their existing binding along so the work behind it stays shared
+Expr *delay_arg(Expr *expr, Environment *env) {
     switch (expr->type) {
-        case VAR: {
-            Expr *value = env_lookup(env, expr->data.var);
-            if (value == NULL) {
-                fprintf(stderr, "Unbound variable: %s\n", expr->data.var);
-                exit(EXIT_FAILURE);
-            }
-            return value;
-        }
-        case LAMBDA:
-            return expr;
-        case APPLY: {
-            Expr *func = eval(expr->data.apply.func, env);
-            Expr *arg = eval(expr->data.apply.arg, env);
-            if (func->type != LAMBDA) {
-                fprintf(stderr, "Attempt to apply non-lambda expression\n");
-                exit(EXIT_FAILURE);
-            }
-            Environment *new_env = env_create(func->data.lambda.param, arg, env);
-            return eval(func->data.lambda.body, new_env);
-        }
         case INT_LITERAL:
+        case FLOAT_LITERAL:
+        case BOOLEAN:
             return expr;
-        case ADD: {
-            Expr *left = eval(expr->data.binop.left, env);
-            Expr *right = eval(expr->data.binop.right, env);
-            if (left->type != INT_LITERAL || right->type != INT_LITERAL) {
-                fprintf(stderr, "Addition requires integer literals\n");
-                exit(EXIT_FAILURE);
-            }
-            return make_int(left->data.int_value + right->data.int_value);
-        }
-        case MULTIPLY: {
-            Expr *left = eval(expr->data.binop.left, env);
-            Expr *right = eval(expr->data.binop.right, env);
-            if (left->type != INT_LITERAL || right->type != INT_LITERAL) {
-                fprintf(stderr, "Multiplication requires integer literals\n");
-                exit(EXIT_FAILURE);
-            }
-            return make_int(left->data.int_value * right->data.int_value);
-        }
+        case LAMBDA:
+            return make_closure(expr, env);
         case QUOTE:
             return expr->data.apply.arg;
-        case DEFINE: {
-            char *var = expr->data.apply.func->data.var;
-            Expr *value = eval(expr->data.apply.arg, env);
-            env = env_create(var, value, env);
-            return value;
+        case GLOBAL_REF:
+            return expr->data.global->value;
+        case VAR: {
+            Expr *value = env_resolve(env, expr->data.var);
+            if (value != NULL) return value;
+            break;  // Only an error if it is ever forced
         }
         default:
-            fprintf(stderr, "Unknown expression type\n");
-            exit(EXIT_FAILURE);
+            break;
     }
+    Expr *thunk = scheme_alloc(sizeof(Expr));
+    thunk->type = THUNK;
+    thunk->data.thunk.expr = expr;
+    thunk->data.thunk.env = env;
+    return thunk;
 }
 
-char *read_token(char **input) {
-    while (isspace(**input)) (*input)++;
-    char *start = *input;
-    if (isalpha(**input)) {
-        while (isalnum(**input)) (*input)++;
-    } else if (isdigit(**input)) {
-        while (isdigit(**input)) (*input)++;
-    } else if (**input == '(' || **input == ')' || **input == '+' || **input == '*') {
-        (*input)++;
-    } else {
-        start = NULL;
-    }
-    int length = *input - start;
-    char *token = malloc(length + 1);
-    strncpy(token, start, length);
-    token[length] = '\0';
-    return token;
+// Memoized procedures (memoize). Results are cached per procedure, keyed by
+// the argument's integer value or, for any other value, its identity (which is
+// structural for hash-consed normal forms). Each cache holds at most
+// memo_capacity entries and evicts by LRU or CLOCK (--memo-policy). Purity is
+// the caller's promise: side effects such as time output happen only on a miss.
+typedef enum { MEMO_LRU, MEMO_CLOCK } MemoPolicy;
+
+typedef struct {
+    int int_key;
+    Expr *key;    // NULL for integer keys
+    Expr *value;
+    int chain;    // Next entry in the same bucket, -1 at the end
+    int prev, next;  // LRU order, most recent first
+    int referenced;  // CLOCK reference bit
+} MemoEntry;
+
+typedef struct MemoCache {
+    Expr *func;
+    int count;
+    MemoEntry *entries;  // memo_capacity slots, also the CLOCK ring
+    int *buckets;        // Twice memo_capacity heads, -1 when empty
+    int bucket_mask;
+    int lru_head, lru_tail;
+    int hand;
+    unsigned long long hits, misses;
+    uint64_t definition;  // Hash of the definition for the disk store, 0 if not persistable
+    char **globals;       // Globals the hash read, bound or not
+    int global_count, global_capacity;
+    struct MemoCache *next_stored;
+} MemoCache;
+
+static int memo_capacity = 1024;  // --memo-capacity N
+static MemoPolicy memo_policy = MEMO_LRU;  // --memo-policy lru|clock
+static int memoize_defines;  // --memoize: every top-level lambda DEFINE is memoized
+
+// Persistent memo store (--memo-store FILE). Results of memoized top-level
+// procedures on integer arguments are appended to FILE as fixed-size records
+// keyed by a hash of the procedure's definition, including the definitions of
+// the globals it refers to. On start the file is memory-mapped once and indexed,
+// so later runs skip the work. Redefining a procedure or anything it calls
+// changes its hash and leaves the old records unreachable, also when the
+// redefinition comes after the procedure was memoized, or defines a global
+// that was unbound then.
+#define MEMO_STORE_MAGIC "SCMMEMO1"
+
+typedef struct {
+    uint64_t definition;
+    int64_t arg;
+    int64_t value;
+    uint64_t check;  // Detects a torn record at the end of the file
+} MemoRecord;
+
+typedef struct {
+    uint64_t definition;
+    int64_t arg;
+    int64_t value;
+    int used;
+} MemoStoreSlot;
+
+typedef struct HashScope {
+    const char *name;
+    struct HashScope *next;
+} HashScope;
+
+static int memo_store_fd = -1;
+static MemoStoreSlot *memo_store_index;
+static size_t memo_store_capacity, memo_store_count;
+static MemoCache *memo_stored;  // Caches with a definition hash
+static MemoCache *hash_reader;  // Notes the globals definition_hash reads
+
+uint64_t hash_mix(uint64_t hash, uint64_t value) {
+    return (hash ^ (value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2))) * 0xff51afd7ed558ccdULL;
 }
 
-Expr *parse_expr(char **input);
+uint64_t hash_string(uint64_t hash, const char *text) {
+    while (*text) hash = hash_mix(hash, (unsigned char)*text++);
+    return hash_mix(hash, 0);
+}
 
-Expr *parse_list(char **input) {
-    char *token = read_token(input);
-    if (strcmp(token, "lambda") == 0) {
-        free(token);
-        char *param = read_token(input);
-        Expr *body = parse_expr(input);
-        free(read_token(input));  // consume closing parenthesis
-        return make_lambda(param, body);
-    } else if (strcmp(token, "+") == 0) {
-        free(token);
-        Expr *left = parse_expr(input);
-        Expr *right = parse_expr(input);
-        free(read_token(input));  // consume closing parenthesis
-        return make_binop(ADD, left, right);
-    } else if (strcmp(token, "*") == 0) {
-        free(token);
-        Expr *left = parse_expr(input);
-        Expr *right = parse_expr(input);
-        free(read_token(input));  // consume closing parenthesis
-        return make_binop(MULTIPLY, left, right);
-    } else if (strcmp(token, "quote") == 0) {
-        free(token);
-        Expr *quoted_expr = parse_expr(input);
-        free(read_token(input));  // consume closing parenthesis
-        Expr *expr = malloc(sizeof(Expr));
-        expr->type = QUOTE;
-        expr->data.apply.arg = quoted_expr;
-        return expr;
-    } else if (strcmp(token, "define") == 0) {
-        free(token);
-        char *var = read_token(input);
-        Expr *value = parse_expr(input);
-        free(read_token(input));  // consume closing parenthesis
-        Expr *expr = malloc(sizeof(Expr));
-        expr->type = DEFINE;
-        expr->data.apply.func = make_var(var);  // Store variable name
-        expr->data.apply.arg = value;  // Store value
-        return expr;
-    } else {
-        Expr *func = make_var(token);
-        Expr *arg = parse_expr(input);
-        free(read_token(input));  // consume closing parenthesis
-        return make_apply(func, arg);
+void memo_add_global(MemoCache *cache, char *var) {
+    for (int i = 0; i < cache->global_count; i++) {
+        if (strcmp(cache->globals[i], var) == 0) return;
     }
+    if (cache->global_count == cache->global_capacity) {
+        cache->global_capacity = cache->global_capacity ? cache->global_capacity * 2 : 4;
+        cache->globals = realloc(cache->globals, cache->global_capacity * sizeof(char *));
+    }
+    cache->globals[cache->global_count++] = var;
 }
 
-Expr *parse_expr(char **input) {
-    char *token = read_token(input);
-    if (token[0] == '(') {
-        free(token);
-        return parse_list(input);
-    } else if (isdigit(token[0])) {
-        int value = atoi(token);
-        free(token);
-        return make_int(value);
-    } else {
-        Expr *var = make_var(token);
-        free(token);
-        return var;
+int scope_contains(HashScope *scope, const char *name) {
+    for (; scope != NULL; scope = scope->next) {
+        if (strcmp(scope->name, name) == 0) return 1;
     }
+    return 0;
 }
 
-void repl() {
-    char input[256];
-    Environment *env = NULL;
+// Structural hash of a definition; free variables hash the values they
+// refer to, captured in env or global, with recursion through a global
+// hashing just its name
+Expr *trace_body(Expr *anchor);
+Expr *lifted_source(Expr *call);
+uint64_t definition_hash(Expr *expr, HashScope *bound, HashScope *visiting, Environment *env);
+Expr *lambda_source(Expr *lambda);
 
-    while (1) {
-        printf("> ");
-        if (!fgets(input, sizeof(input), stdin)) break;
-        char *p = input;
-        Expr *expr = parse_expr(&p);
-        Expr *result = eval(expr, env);
-        if (result->type == INT_LITERAL) {
-            printf("%d\n", result->data.int_value);
-        } else {
-            printf("Expression evaluated.\n");
+// Differs from run to run, for values with no content to hash: nothing
+// recorded under them is served to a later run
+uint64_t run_nonce(void) {
+    static uint64_t nonce;
+    if (nonce == 0) nonce = hash_mix(hash_mix(now_ns(), (uint64_t)getpid()), (uint64_t)(uintptr_t)&nonce) | 1;
+    return nonce;
+}
+
+uint64_t value_hash(uint64_t hash, Expr *value, HashScope *visiting) {
+    if (value->type == MEMO) value = value->data.memo->func;
+    switch (value->type) {
+        case CLOSURE: {
+            // As written: what a compiled body inlined depends on the profile
+            Expr *lambda = value->data.closure.lambda;
+            Expr source = { .type = LAMBDA, .data.lambda = { lambda->data.lambda.param, lambda_source(lambda) } };
+            return hash_mix(hash, definition_hash(&source, NULL, visiting, value->data.closure.env));
         }
-        // Free memory allocated for the expression (not implemented here)
+        case INT_LITERAL:
+            return hash_mix(hash, (uint64_t)value->data.int_value);
+        case BOOLEAN:
+            return hash_mix(hash_mix(hash, BOOLEAN), (uint64_t)value->data.int_value);
+        case FLOAT_LITERAL:
+            return hash_mix(hash, number_double(value->data.float_value));
+        case NIL:
+            return hash_mix(hash, NIL);
+        default:
+            return hash_mix(hash_mix(hash, run_nonce()), (uint64_t)(uintptr_t)value);
+    }
+}
+
+uint64_t definition_hash(Expr *expr, HashScope *bound, HashScope *visiting, Environment *env) {
+    if (expr->type == TRACE_ANCHOR) return definition_hash(trace_body(expr), bound, visiting, env);
+    if (expr->type == LIFTED_CALL) return definition_hash(lifted_source(expr), bound, visiting, env);
+    ExprType type = base_type(expr->type);
+    uint64_t hash = hash_mix(0x5eed, type);
+    switch (type) {
+        case VAR:
+        case GLOBAL_REF: {
+            char *var = expr->type == VAR ? expr->data.var : expr->data.global->var;
+            hash = hash_mix(hash_string(0x5eed, var), VAR);  // Compiled references hash like the source
+            if (expr->type == VAR && scope_contains(bound, var)) return hash;
+            Expr *captured = expr->type == VAR ? env_lookup(env, var) : NULL;
+            if (captured != NULL) return value_hash(hash, captured, visiting);
+            if (hash_reader != NULL) memo_add_global(hash_reader, var);
+            if (scope_contains(visiting, var)) return hash;
+            Expr *global = env_lookup(global_env, var);
+            if (global == NULL) return hash;
+            HashScope inner = { var, visiting };
+            return value_hash(hash, global, &inner);
+        }
+        case INT_LITERAL:
+        case BOOLEAN:
+            return hash_mix(hash, (uint64_t)expr->data.int_value);
+        case FLOAT_LITERAL:
+            return hash_mix(hash, number_double(expr->data.float_value));
+        case LAMBDA: {
+            HashScope param = { expr->data.lambda.param, bound };
+            hash = hash_string(hash, expr->data.lambda.param);
+            return hash_mix(hash, definition_hash(expr->data.lambda.body, &param, visiting, env));
+        }
+        case APPLY:
+        case DEFINE:
+            hash = hash_mix(hash, definition_hash(expr->data.apply.func, bound, visiting, env));
+            return hash_mix(hash, definition_hash(expr->data.apply.arg, bound, visiting, env));
+        case IF:
+        case BRANCHES:
+            hash = hash_mix(hash, definition_hash(expr->data.binop.left, bound, visiting, env));
+            return hash_mix(hash, definition_hash(expr->data.binop.right, bound, visiting, env));
+        default: {
+            const SpecialForm *form = special_form_of(type);
+            if (form == NULL) return hash_mix(hash, (uint64_t)(uintptr_t)expr);
+            if (form->arity == 1) return hash_mix(hash, definition_hash(expr->data.apply.arg, bound, visiting, env));
+            hash = hash_mix(hash, definition_hash(expr->data.binop.left, bound, visiting, env));
+            return hash_mix(hash, definition_hash(expr->data.binop.right, bound, visiting, env));
+        }
+    }
+}
+
+uint64_t memo_record_check(uint64_t definition, int64_t arg, int64_t value) {
+    return hash_mix(hash_mix(hash_mix(0x4d454d4f, definition), (uint64_t)arg), (uint64_t)value);
+}
+
+MemoStoreSlot *memo_store_slot(uint64_t definition, int64_t arg) {
+    size_t mask = memo_store_capacity - 1;
+    size_t i = hash_mix(definition, (uint64_t)arg) & mask;
+    while (memo_store_index[i].used &&
+           (memo_store_index[i].definition != definition || memo_store_index[i].arg != arg)) {
+        i = (i + 1) & mask;
     }
+    return &memo_store_index[i];
 }
 
-int main() {
+void memo_store_insert(uint64_t definition, int64_t arg, int64_t value) {
+    if (2 * (memo_store_count + 1) > memo_store_capacity) {
+        MemoStoreSlot *old = memo_store_index;
+        size_t old_capacity = memo_store_capacity;
+        memo_store_capacity = old_capacity ? old_capacity * 2 : 1024;
+        memo_store_index = calloc(memo_store_capacity, sizeof(MemoStoreSlot));
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old[i].used) *memo_store_slot(old[i].definition, old[i].arg) = old[i];
+        }
+        free(old);
+    }
+    MemoStoreSlot *slot = memo_store_slot(definition, arg);
+    if (!slot->used) memo_store_count++;
+    slot->definition = definition;
+    slot->arg = arg;
+    slot->value = value;
+    slot->used = 1;
+}
+
+int memo_store_open(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Cannot open memo store: %s\n", path);
+        return 0;
+    }
+    size_t header = sizeof(MEMO_STORE_MAGIC) - 1;
+    if (st.st_size == 0) {
+        if (write(fd, MEMO_STORE_MAGIC, header) != (ssize_t)header) {
+            fprintf(stderr, "Cannot write memo store: %s\n", path);
+            close(fd);
+            return 0;
+        }
+    } else {
+        char *map = st.st_size >= (off_t)header ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (map == MAP_FAILED || memcmp(map, MEMO_STORE_MAGIC, header) != 0) {
+            fprintf(stderr, "Not a memo store: %s\n", path);
+            if (map != MAP_FAILED) munmap(map, st.st_size);
+            close(fd);
+            return 0;
+        }
+        size_t records = (st.st_size - header) / sizeof(MemoRecord);
+        const MemoRecord *record = (const MemoRecord *)(map + header);
+        for (size_t i = 0; i < records; i++, record++) {
+            MemoRecord r;
+            memcpy(&r, record, sizeof(r));
+            if (r.check != memo_record_check(r.definition, r.arg, r.value)) break;
+            memo_store_insert(r.definition, r.arg, r.value);
+        }
+        munmap(map, st.st_size);
+        // Drop a torn tail so appended records stay aligned
+        if (ftruncate(fd, header + records * sizeof(MemoRecord)) < 0) {
+            fprintf(stderr, "Cannot repair memo store: %s\n", path);
+        }
+    }
+    memo_store_fd = fd;
+    return 1;
+}
+
+int memo_store_lookup(uint64_t definition, int arg, int *value) {
+    if (memo_store_capacity == 0) return 0;
+    MemoStoreSlot *slot = memo_store_slot(definition, arg);
+    if (!slot->used) return 0;
+    *value = (int)slot->value;
+    return 1;
+}
+
+void memo_store_append(uint64_t definition, int arg, int value) {
+    MemoRecord r = { definition, arg, value, memo_record_check(definition, arg, value) };
+    if (write(memo_store_fd, &r, sizeof(r)) != (ssize_t)sizeof(r)) {
+        fprintf(stderr, "Cannot append to memo store\n");
+        return;
+    }
+    memo_store_insert(definition, arg, value);
+}
+
+// Hash the definition as written, noting the globals the hash read
+void memo_rehash(MemoCache *cache) {
+    Expr *lambda = cache->func->data.closure.lambda;
+    Expr source = { .type = LAMBDA, .data.lambda = { lambda->data.lambda.param, lambda_source(lambda) } };
+    cache->global_count = 0;
+    hash_reader = cache;
+    cache->definition = definition_hash(&source, NULL, NULL, NULL);
+    hash_reader = NULL;
+}
+
+// name was (re)defined: results of the stored procedures that read it are
+// keyed under a new hash from now on
+void memo_redefined(char *name) {
+    for (MemoCache *cache = memo_stored; cache != NULL; cache = cache->next_stored) {
+        for (int i = 0; i < cache->global_count; i++) {
+            if (strcmp(cache->globals[i], name) != 0) continue;
+            memo_rehash(cache);
+            break;
+        }
+    }
+}
+
+Expr *make_memo(Expr *func) {
+    MemoCache *cache = scheme_alloc(sizeof(MemoCache));
+    int buckets = 1;
+    while (buckets < 2 * memo_capacity) buckets <<= 1;
+    cache->func = func;
+    cache->count = 0;
+    cache->entries = scheme_alloc(memo_capacity * sizeof(MemoEntry));
+    cache->buckets = scheme_alloc(buckets * sizeof(int));
+    memset(cache->buckets, -1, buckets * sizeof(int));
+    cache->bucket_mask = buckets - 1;
+    cache->lru_head = cache->lru_tail = -1;
+    cache->hand = 0;
+    cache->hits = cache->misses = 0;
+    cache->definition = 0;
+    cache->globals = NULL;
+    cache->global_count = cache->global_capacity = 0;
+    if (memo_store_fd >= 0 && func->data.closure.env == NULL) {
+        memo_rehash(cache);
+        cache->next_stored = memo_stored;
+        memo_stored = cache;
+    }
+    Expr *expr = scheme_alloc(sizeof(Expr));
+    expr->type = MEMO;
+    expr->data.memo = cache;
+    return expr;
+}
+
+int memo_bucket(MemoCache *cache, int int_key, Expr *key) {
+    size_t hash = key ? (size_t)key >> 4 : (size_t)(unsigned)int_key;
+    hash *= 0x9e3779b97f4a7c15ULL;
+    return (int)((hash >> 32) & cache->bucket_mask);
+}
+
+void memo_lru_unlink(MemoCache *cache, int i) {
+    MemoEntry *e = &cache->entries[i];
+    if (e->prev >= 0) cache->entries[e->prev].next = e->next;
+    else cache->lru_head = e->next;
+    if (e->next >= 0) cache->entries[e->next].prev = e->prev;
+    else cache->lru_tail = e->prev;
+}
+
+void memo_lru_push(MemoCache *cache, int i) {
+    MemoEntry *e = &cache->entries[i];
+    e->prev = -1;
+    e->next = cache->lru_head;
+    if (cache->lru_head >= 0) cache->entries[cache->lru_head].prev = i;
+    cache->lru_head = i;
+    if (cache->lru_tail < 0) cache->lru_tail = i;
+}
+
+// Pick a slot for a new entry, evicting one when the cache is full
+int memo_victim(MemoCache *cache) {
+    if (cache->count < memo_capacity) return cache->count++;
+    int victim;
+    if (memo_policy == MEMO_LRU) {
+        victim = cache->lru_tail;
+        memo_lru_unlink(cache, victim);
+    } else {
+        while (cache->entries[cache->hand].referenced) {
+            cache->entries[cache->hand].referenced = 0;
+            cache->hand = (cache->hand + 1) % memo_capacity;
+        }
+        victim = cache->hand;
+        cache->hand = (cache->hand + 1) % memo_capacity;
+    }
+    MemoEntry *old = &cache->entries[victim];
+    int *link = &cache->buckets[memo_bucket(cache, old->int_key, old->key)];
+    while (*link != victim) link = &cache->entries[*link].chain;
+    *link = old->chain;
+    return victim;
+}
+
+Expr *apply_closure(Expr *func, Expr *arg);
+
+Expr *memo_apply(MemoCache *cache, Expr *arg) {
+    arg = force(arg);
+    Expr *key = arg->type == INT_LITERAL ? NULL : arg;
+    int int_key = key ? 0 : arg->data.int_value;
+    int bucket = memo_bucket(cache, int_key, key);
+    for (int i = cache->buckets[bucket]; i >= 0; i = cache->entries[i].chain) {
+        MemoEntry *e = &cache->entries[i];
+        if (e->key != key || (key == NULL && e->int_key != int_key)) continue;
+        cache->hits++;
+        if (memo_policy == MEMO_LRU) {
+            memo_lru_unlink(cache, i);
+            memo_lru_push(cache, i);
+        } else {
+            e->referenced = 1;
+        }
+        return e->value;
+    }
+    cache->misses++;
+    Expr *value;
+    int stored;
+    int persist = cache->definition != 0 && key == NULL;
+    if (persist && memo_store_lookup(cache->definition, int_key, &stored)) {
+        value = make_int(stored);
+    } else {
+        value = apply_closure(cache->func, arg);
+        if (persist && value->type == INT_LITERAL) memo_store_append(cache->definition, int_key, value->data.int_value);
+    }
+    int i = memo_victim(cache);
+    MemoEntry *e = &cache->entries[i];
+    e->int_key = int_key;
+    e->key = key;
+    e->value = value;
+    e->referenced = 0;
+    e->chain = cache->buckets[bucket];
+    cache->buckets[bucket] = i;
+    if (memo_policy == MEMO_LRU) memo_lru_push(cache, i);
+    return value;
+}
+
+// Per-evaluation budgets (--fuel, --heap-limit, --timeout). Calls and loop
+// back-edges are safepoints; each decrements a countdown and only when it
+// runs out are the step, heap and clock limits checked, so an unlimited
+// evaluation pays one decrement per safepoint.
+#define SAFEPOINT_INTERVAL 1024  // Steps between heap and clock checks
+
+typedef struct {
+    long long fuel;           // Steps per evaluation, 0 for unlimited
+    unsigned long long heap;  // Bytes allocated per evaluation, 0 for unlimited
+    unsigned long long timeout_ns;
+} Budget;
+
+Budget budget;
+static long long safepoint_countdown = LLONG_MAX;
+static long long safepoint_period;  // Countdown the last check started from
+static long long budget_steps;
+static unsigned long long budget_heap_start, budget_deadline;
+
+void budget_check(void);
+
+void budget_start(void) {
+    budget_steps = 0;
+    budget_heap_start = alloc_bytes;
+    if (budget.timeout_ns) budget_deadline = now_ns() + budget.timeout_ns;
+    safepoint_period = 0;
+    safepoint_countdown = budget.fuel || budget.heap || budget.timeout_ns ? 0 : LLONG_MAX;
+    if (safepoint_countdown == 0) budget_check();
+}
+
+void budget_check(void) {
+    budget_steps += safepoint_period;
+    if (budget.fuel && budget_steps > budget.fuel) {
+        scheme_error("budget", "Fuel exhausted after %lld steps", budget.fuel);
+    }
+    if (budget.heap && alloc_bytes - budget_heap_start > budget.heap) {
+        scheme_error("budget", "Heap limit exceeded: %llu bytes allocated", alloc_bytes - budget_heap_start);
+    }
+    if (budget.timeout_ns && now_ns() > budget_deadline) {
+        scheme_error("budget", "Timed out after %llu ms", budget.timeout_ns / 1000000);
+    }
+    long long next = SAFEPOINT_INTERVAL;
+    if (budget.fuel && budget.fuel - budget_steps + 1 < next) next = budget.fuel - budget_steps + 1;
+    safepoint_period = safepoint_countdown = next;
+}
+
+// Whether budget_check would raise an error now
+int budget_spent(void) {
+    return (budget.fuel && budget_steps + safepoint_period > budget.fuel) ||
+           (budget.heap && alloc_bytes - budget_heap_start > budget.heap) ||
+           (budget.timeout_ns && now_ns() > budget_deadline);
+}
+
+#define SAFEPOINT() do { if (--safepoint_countdown <= 0) budget_check(); } while (0)
+
+static const char *pgo_path;  // --profile: collect a profile and save it on exit
+struct PgoCounts *pgo_enter(struct PgoCounts *caller, Expr *lambda);
+
+// Calls recurse on the C stack, so a runaway recursion would overflow it long
+// before any budget ran out; apply_closure stops it while it still can unwind
+static char *stack_base;
+static size_t stack_limit;
+
+void stack_init(char *base) {
+    struct rlimit limit;
+    size_t size = 8 << 20;
+    if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) size = limit.rlim_cur;
+    stack_base = base;
+    stack_limit = size - (size > (2 << 20) ? (1 << 20) : size / 2);  // Headroom for the unwind
+}
+
+Expr *apply_closure(Expr *func, Expr *arg) {
+    SAFEPOINT();
+    if ((size_t)(stack_base - (char *)__builtin_frame_address(0)) > stack_limit) {
+        scheme_error("budget", "Recursion too deep");
+    }
+    if (func->type == MEMO) return memo_apply(func->data.memo, arg);
+    if (func->type == CONTINUATION) continuation_throw(func->data.continuation, force(arg));
+    if (func->type != CLOSURE) {
+        scheme_error("type-error", "Attempt to apply non-lambda expression");
+    }
+    Expr *lambda = func->data.closure.lambda;
+    Environment *new_env = env_create(lambda->data.lambda.param, arg, func->data.closure.env);
+    PROBE2(apply__entry, func, lambda->data.lambda.param);
+    struct PgoCounts *caller = pgo_current;
+    if (pgo_path) pgo_current = pgo_enter(caller, lambda);
+    Expr *result = eval(lambda->data.lambda.body, new_env);
+    pgo_current = caller;
+    PROBE2(apply__return, func, result);
+    return result;
+}
+
+static Expr nil = { .type = NIL };
+static Expr true_value = { .type = BOOLEAN, .data.int_value = 1 };
+static Expr false_value = { .type = BOOLEAN, .data.int_value = 0 };
+
+Expr *make_boolean(int value) {
+    return value ? &true_value : &false_value;
+}
+
+// Everything but #f is true. A forced thunk holds a copy of its value, so
+// compare contents rather than against false_value
+int is_true(Expr *value) {
+    return value->type != BOOLEAN || value->data.int_value;
+}
+
+#define STREAM_CHUNK 32  // Elements produced per force of an iterated stream
+
+// Produce the next chunk of (stream-iterate f seed): STREAM_CHUNK elements
+// already forced, ending in a promise for the rest
+Expr *stream_chunk(PromiseBox *box) {
+    Expr *head = NULL, *last = NULL;
+    Expr *value = box->seed;
+    for (int i = 0; i < STREAM_CHUNK; i++) {
+        Expr *pair = make_binop(PAIR, value, NULL);
+        if (last) last->data.binop.right = make_promise(PROMISE_DONE, pair, NULL);
+        else head = pair;
+        last = pair;
+        value = apply_closure(box->expr, value);
+    }
+    Expr *rest = make_promise(PROMISE_ITERATE, box->expr, NULL);
+    rest->data.promise->seed = value;
+    last->data.binop.right = rest;
+    return head;
+}
+
+// SRFI-45 force: a delay-force chain is followed iteratively, with each
+// intermediate promise sharing the outer box, so it runs in constant space
+Expr *force_promise(Expr *promise) {
+    while (1) {
+        SAFEPOINT();
+        PromiseBox *box = promise->data.promise;
+        switch (box->state) {
+            case PROMISE_DONE:
+                return box->expr;
+            case PROMISE_DELAY:
+            case PROMISE_ITERATE: {
+                Expr *value = box->state == PROMISE_DELAY ? eval(box->expr, box->env) : stream_chunk(box);
+                if (box->state != PROMISE_DONE) {  // Unless forced re-entrantly meanwhile
+                    box->state = PROMISE_DONE;
+                    box->expr = value;
+                    box->env = NULL;
+                }
+                return box->expr;
+            }
+            case PROMISE_LAZY: {
+                Expr *next = eval(box->expr, box->env);
+                if (next->type != PROMISE) {  // e.g. nil ending a stream
+                    next = make_promise(PROMISE_DONE, next, NULL);
+                }
+                if (box->state != PROMISE_DONE) {
+                    *box = *next->data.promise;
+                    next->data.promise = box;
+                }
+                break;
+            }
+        }
+    }
+}
+
+int values_equal(Expr *a, Expr *b) {
+    return a == b || (a->type == INT_LITERAL && b->type == INT_LITERAL && a->data.int_value == b->data.int_value) ||
+           (a->type == FLOAT_LITERAL && b->type == FLOAT_LITERAL && a->data.float_value == b->data.float_value) ||
+           (a->type == BOOLEAN && b->type == BOOLEAN && a->data.int_value == b->data.int_value);
+}
+
+// Incremental computation (Adapton). (ref e) is a modifiable reference and
+// (adapt e) a memoized thunk. Every get inside a thunk records an edge to what
+// it read, together with the value it saw. set-ref! only marks the dependents
+// dirty, transitively. A later get of a dirty thunk re-checks its edges in the
+// order they were recorded and recomputes only if one of them now yields a
+// different value, so untouched parts of the graph are reused.
+typedef struct AdaptEdge {
+    struct AdaptNode *from;  // Thunk that performed the get
+    struct AdaptNode *to;
+    Expr *observed;
+    int dirty;
+    int dead;  // Dropped by a recomputation of from; unlinked from to lazily
+    struct AdaptEdge *next_dep;        // In from's dependency list
+    struct AdaptEdge *next_dependent;  // In to's dependent list
+} AdaptEdge;
+
+typedef struct AdaptNode {
+    int is_thunk;
+    int computed;
+    int dirty;
+    Expr *value;
+    Expr *expr;  // Thunk body
+    Environment *env;
+    AdaptEdge *deps;
+    AdaptEdge **deps_tail;
+    AdaptEdge *dependents;
+} AdaptNode;
+
+
+Expr *make_adapton(int is_thunk, Expr *value, Expr *body, Environment *env) {
+    AdaptNode *node = scheme_alloc(sizeof(AdaptNode));
+    node->is_thunk = is_thunk;
+    node->computed = !is_thunk;
+    node->dirty = 0;
+    node->value = value;
+    node->expr = body;
+    node->env = env;
+    node->deps = NULL;
+    node->deps_tail = &node->deps;
+    node->dependents = NULL;
+    Expr *expr = scheme_alloc(sizeof(Expr));
+    expr->type = ADAPTON;
+    expr->data.adapton = node;
+    return expr;
+}
+
+void adapt_dirty(AdaptNode *node) {
+    for (AdaptEdge **link = &node->dependents; *link != NULL;) {
+        AdaptEdge *edge = *link;
+        if (edge->dead) {
+            *link = edge->next_dependent;
+            continue;
+        }
+        if (!edge->dirty) {
+            edge->dirty = 1;
+            if (!edge->from->dirty) {
+                edge->from->dirty = 1;
+                adapt_dirty(edge->from);
+            }
+        }
+        link = &edge->next_dependent;
+    }
+}
+
+// The node counts as uncomputed until its body returns, so one abandoned by
+// an error or an escape is computed afresh next time rather than cleaned
+// against the partial dependencies it recorded
+void adapt_compute(AdaptNode *node) {
+    for (AdaptEdge *edge = node->deps; edge != NULL; edge = edge->next_dep) edge->dead = 1;
+    node->deps = NULL;
+    node->deps_tail = &node->deps;
+    node->computed = 0;
+    AdaptNode *outer = adapt_current;
+    adapt_current = node;
+    node->value = eval(node->expr, node->env);
+    adapt_current = outer;
+    node->computed = 1;
+    node->dirty = 0;
+}
+
+Expr *adapt_get(AdaptNode *node);
+
+// Bring a dirty thunk up to date, recomputing only if a dependency changed
+void adapt_clean(AdaptNode *node) {
+    for (AdaptEdge *edge = node->deps; edge != NULL; edge = edge->next_dep) {
+        if (!edge->dirty) continue;
+        AdaptNode *dep = edge->to;
+        if (dep->is_thunk && !dep->computed) adapt_compute(dep);
+        else if (dep->is_thunk && dep->dirty) adapt_clean(dep);
+        edge->dirty = 0;
+        if (!values_equal(dep->value, edge->observed)) {
+            adapt_compute(node);
+            return;
+        }
+    }
+    node->dirty = 0;
+}
+
+Expr *adapt_get(AdaptNode *node) {
+    if (node->is_thunk) {
+        if (!node->computed) adapt_compute(node);
+        else if (node->dirty) adapt_clean(node);
+    }
+    if (adapt_current != NULL) {
+        AdaptEdge *edge = scheme_alloc(sizeof(AdaptEdge));
+        edge->from = adapt_current;
+        edge->to = node;
+        edge->observed = node->value;
+        edge->dirty = edge->dead = 0;
+        edge->next_dep = NULL;
+        *adapt_current->deps_tail = edge;
+        adapt_current->deps_tail = &edge->next_dep;
+        edge->next_dependent = node->dependents;
+        node->dependents = edge;
+    }
+    return node->value;
+}
+
+Expr *force_stream(Expr *stream) {
+    Expr *pair = stream->type == PROMISE ? force_promise(stream) : stream;
+    if (pair->type != PAIR) {
+        scheme_error("type-error", "Stream is empty or not a stream");
+    }
+    return pair;
+}
+
+// Top-level lambda definitions are compiled when defined: references to
+// globals are bound directly to their binding, integer constants and small
+// known functions are inlined and constant arithmetic is folded. Each compiled
+// lambda records the globals whose values it baked in; redefining one of them
+// recompiles just those lambdas. --no-inline turns compilation off.
+#define INLINE_MAX_NODES 16
+#define INLINE_MAX_DEPTH 4
+
+// Profile-guided optimization (--profile FILE). While profiling, each
+// top-level lambda counts its calls, the operand types its arithmetic and
+// comparisons see, which top-level lambdas it calls and which way each of
+// its ifs goes. Lambdas written inside it count towards it wherever their
+// closures are called. On exit the counts are merged into FILE, keyed by
+// name and definition hash so that edited definitions start afresh. A later
+// run loads FILE and compiles with it from the first definition:
+// - hot callers and hot call edges get a larger inlining budget, and
+//   never-called lambdas none;
+// - a branch that was never taken while the other one was is not inlined into;
+// - a call through a variable whose calls nearly all went to one top-level
+//   lambda inlines that lambda behind an identity check;
+// - the JIT starts on the first call of a hot lambda whose arithmetic saw
+//   only integers or only floats, which its traces specialize on.
+#define PGO_MAX_TARGETS 4    // Distinct callees recorded per lambda
+#define PGO_MAX_BRANCHES 16  // Ifs counted per lambda, in compile order
+#define PGO_HOT_CALLS 1000   // Calls in the saved profile that make a lambda or call edge hot
+
+typedef struct {
+    char *name;
+    unsigned long long count;
+} PgoTarget;
+
+typedef struct PgoCounts {
+    unsigned long long calls;
+    unsigned long long int_ops, other_ops;  // Arithmetic and comparisons by operand type
+    PgoTarget targets[PGO_MAX_TARGETS];
+    int target_count;
+    unsigned long long branches[PGO_MAX_BRANCHES][2];  // Then and else taken, per if
+} PgoCounts;
+
+// A lambda's entry in the loaded profile
+typedef struct PgoRecord {
+    char *name;
+    uint64_t hash;
+    PgoCounts counts;
+    int matched;  // Claimed by a definition this run
+    struct PgoRecord *next;
+} PgoRecord;
+
+static PgoRecord *pgo_records;
+
+typedef struct CompiledLambda {
+    char *name;
+    Expr *lambda;  // Shared with the closure; its body is replaced on each compile
+    Expr *source;  // Body as parsed
+    char **deps;   // Globals whose values were baked in (or that were unbound)
+    int dep_count, dep_capacity;
+    uint64_t hash;      // definition_hash of the lambda as defined
+    PgoCounts counts;   // This run
+    PgoRecord *prior;   // Saved profile of the same definition, if any
+    int branch_count;   // Ifs numbered by the compile in progress
+    int cold;           // Compiling a branch the profile never saw taken
+    struct CompiledLambda *next;
+} CompiledLambda;
+
+// Counters an if or an inner lambda refers to by its site: the if's branch
+// counts, or the definition whose code made the lambda's first closure
+typedef struct {
+    PgoCounts *counts;
+    int branch;  // -1 for a lambda
+} PgoSite;
+
+static PgoSite *pgo_sites;  // Entry 0 is unused
+static int pgo_site_count = 1, pgo_site_capacity;
+
+int pgo_site(PgoCounts *counts, int branch) {
+    if (pgo_site_count >= pgo_site_capacity) {
+        pgo_site_capacity = pgo_site_capacity ? pgo_site_capacity * 2 : 64;
+        pgo_sites = realloc(pgo_sites, pgo_site_capacity * sizeof(PgoSite));
+    }
+    pgo_sites[pgo_site_count].counts = counts;
+    pgo_sites[pgo_site_count].branch = branch;
+    return pgo_site_count++;
+}
+
+void pgo_count_branch(int site, int taken) {
+    pgo_sites[site].counts->branches[pgo_sites[site].branch][!taken]++;
+}
+
+static CompiledLambda *compiled_lambdas;
+static int inline_enabled = 1;
+static unsigned long long recompilations;
+
+// Body of lambda as parsed, even once compiled
+Expr *lambda_source(Expr *lambda) {
+    for (CompiledLambda *c = compiled_lambdas; c != NULL; c = c->next) {
+        if (c->lambda == lambda) return c->source;
+    }
+    return lambda->data.lambda.body;
+}
+
+Environment *global_cell(char *var) {
+    for (Environment *cell = global_env; cell != NULL; cell = cell->next) {
+        if (strcmp(cell->var, var) == 0) return cell;
+    }
+    return NULL;
+}
+
+Expr *make_global_ref(Environment *cell) {
+    Expr *expr = scheme_alloc(sizeof(Expr));
+    expr->type = GLOBAL_REF;
+    expr->data.global = cell;
+    return expr;
+}
+
+void compiled_add_dep(CompiledLambda *unit, char *var) {
+    for (int i = 0; i < unit->dep_count; i++) {
+        if (strcmp(unit->deps[i], var) == 0) return;
+    }
+    if (unit->dep_count == unit->dep_capacity) {
+        unit->dep_capacity = unit->dep_capacity ? unit->dep_capacity * 2 : 4;
+        unit->deps = realloc(unit->deps, unit->dep_capacity * sizeof(char *));
+    }
+    unit->deps[unit->dep_count++] = var;
+}
+
+// Lambda lifting. A lambda that is only called where it is written needs no
+// closure: it is lifted to a function whose parameters are its free local
+// variables followed by its own, and the call binds them all in a fresh
+// frame. Saturated calls of curried top-level functions such as ((add x) 7)
+// are lifted the same way, so the inner lambda is never allocated. A lifted
+// call keeps the application it replaced for printing, hashing and
+// normalization. --no-lift keeps the closures.
+#define LIFT_MAX_PARAMS 8
+
+typedef struct Lifted {
+    char *params[LIFT_MAX_PARAMS];  // Free local variables first, then the lambda's own
+    Expr *args[LIFT_MAX_PARAMS];
+    int count;
+    Expr *body;
+    Expr *source;  // The application before lifting
+} Lifted;
+
+static int lift_enabled = 1;
+static unsigned long long lifted_sites;
+
+Expr *make_lifted_call(Lifted *lifted) {
+    Expr *expr = scheme_alloc(sizeof(Expr));
+    expr->type = LIFTED_CALL;
+    expr->data.lifted = scheme_alloc(sizeof(Lifted));
+    *expr->data.lifted = *lifted;
+    return expr;
+}
+
+Expr *lifted_source(Expr *call) {
+    return call->data.lifted->source;
+}
+
+// Bodies that may be substituted into a call site: no binders, quotes or
+// effects, and no free names besides the parameter
+int inlinable(Expr *body, char *param, int *budget) {
+    if (--*budget < 0) return 0;
+    switch (body->type) {
+        case VAR:
+            return strcmp(body->data.var, param) == 0;
+        case INT_LITERAL:
+        case FLOAT_LITERAL:
+        case BOOLEAN:
+        case GLOBAL_REF:
+            return 1;
+        case APPLY:
+            return inlinable(body->data.apply.func, param, budget) && inlinable(body->data.apply.arg, param, budget);
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY:
+        case EQ:
+        case LESS:
+        case NUM_EQUAL:
+        case IF:
+        case BRANCHES:
+            return inlinable(body->data.binop.left, param, budget) && inlinable(body->data.binop.right, param, budget);
+        case LIFTED_CALL:  // The lifted body sees only its own parameters
+            for (int i = 0; i < body->data.lifted->count; i++) {
+                if (!inlinable(body->data.lifted->args[i], param, budget)) return 0;
+            }
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+Expr *substitute(Expr *body, char *param, Expr *arg) {
+    switch (body->type) {
+        case VAR:
+            return arg;  // inlinable() allows only the parameter
+        case APPLY:
+            return make_apply(substitute(body->data.apply.func, param, arg), substitute(body->data.apply.arg, param, arg));
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY:
+        case EQ:
+        case LESS:
+        case NUM_EQUAL:
+        case IF:
+        case BRANCHES:
+            return make_binop(body->type, substitute(body->data.binop.left, param, arg),
+                              substitute(body->data.binop.right, param, arg));
+        case LIFTED_CALL: {
+            Lifted lifted = *body->data.lifted;
+            for (int i = 0; i < lifted.count; i++) lifted.args[i] = substitute(lifted.args[i], param, arg);
+            lifted.source = substitute(lifted.source, param, arg);
+            return make_lifted_call(&lifted);
+        }
+        default:
+            return body;
+    }
+}
+
+Expr *compile_expr(CompiledLambda *unit, Expr *expr, HashScope *bound, int depth);
+
+// Profiled calls from counts to the top-level lambda name
+unsigned long long pgo_edge(PgoCounts *counts, const char *name) {
+    for (int i = 0; i < counts->target_count; i++) {
+        if (strcmp(counts->targets[i].name, name) == 0) return counts->targets[i].count;
+    }
+    return 0;
+}
+
+// 1 if name occurs in expr as a variable
+int mentions(Expr *expr, const char *name) {
+    switch (expr->type) {
+        case VAR:
+            return strcmp(expr->data.var, name) == 0;
+        case LAMBDA:
+            return mentions(expr->data.lambda.body, name);
+        case APPLY:
+        case DEFINE:
+            return mentions(expr->data.apply.func, name) || mentions(expr->data.apply.arg, name);
+        case IF:
+        case BRANCHES:
+            return mentions(expr->data.binop.left, name) || mentions(expr->data.binop.right, name);
+        case QUOTE:
+            return 0;
+        default: {
+            const SpecialForm *form = special_form_of(expr->type);
+            if (form == NULL) return 0;
+            if (form->arity == 1) return mentions(expr->data.apply.arg, name);
+            return mentions(expr->data.binop.left, name) || mentions(expr->data.binop.right, name);
+        }
+    }
+}
+
+// Inline (f arg) when f is a small top-level function and arg is atomic
+Expr *compile_inline(CompiledLambda *unit, Expr *func, Expr *arg, HashScope *bound, int depth) {
+    if (func->type != GLOBAL_REF || depth >= INLINE_MAX_DEPTH) return NULL;
+    if (arg->type != VAR && arg->type != INT_LITERAL && arg->type != FLOAT_LITERAL && arg->type != BOOLEAN &&
+        arg->type != GLOBAL_REF) {
+        return NULL;
+    }
+    Environment *cell = func->data.global;
+    if (strcmp(cell->var, unit->name) == 0 || unit->cold) return NULL;
+    Expr *callee = cell->value;
+    if (callee->type != CLOSURE || callee->data.closure.env != NULL) return NULL;
+    Expr *lambda = callee->data.closure.lambda;
+    Expr *source = lambda->data.lambda.body;
+    for (CompiledLambda *c = compiled_lambdas; c != NULL; c = c->next) {
+        if (c->lambda == lambda) source = c->source;
+    }
+    // Compile the callee in its own scope first so its free names resolve to globals
+    HashScope param = { lambda->data.lambda.param, NULL };
+    Expr *body = compile_expr(unit, source, &param, depth + 1);
+    int budget = INLINE_MAX_NODES;
+    if (unit->prior != NULL) {
+        PgoCounts *prior = &unit->prior->counts;
+        // Calls that were inlined while profiling made no edge, so a missing one says nothing
+        if (prior->calls == 0) budget = 0;  // Cold: keep the call, skip the code growth
+        else if (prior->calls >= PGO_HOT_CALLS || (depth == 0 && pgo_edge(prior, cell->var) >= PGO_HOT_CALLS)) budget *= 4;
+    }
+    if (!inlinable(body, lambda->data.lambda.param, &budget)) return NULL;
+    compiled_add_dep(unit, cell->var);
+    return compile_expr(unit, substitute(body, lambda->data.lambda.param, arg), bound, depth + 1);
+}
+
+// (f arg) with f a local variable, when nearly all the calls the profile saw
+// through variables, to lambdas the source never names, went to one of them:
+// (if (eq f target) <target inlined> (f arg))
+Expr *compile_speculate(CompiledLambda *unit, Expr *func, Expr *arg, HashScope *bound, int depth) {
+    if (depth > 0 || unit->prior == NULL || unit->cold || func->type != VAR || !scope_contains(bound, func->data.var)) {
+        return NULL;
+    }
+    PgoCounts *prior = &unit->prior->counts;
+    unsigned long long total = 0;
+    int best = -1;
+    for (int i = 0; i < prior->target_count; i++) {
+        if (mentions(unit->source, prior->targets[i].name)) continue;  // Called directly
+        total += prior->targets[i].count;
+        if (best < 0 || prior->targets[i].count > prior->targets[best].count) best = i;
+    }
+    if (best < 0 || prior->targets[best].count * 10 < total * 9) return NULL;
+    Environment *cell = global_cell(prior->targets[best].name);
+    if (cell == NULL) return NULL;
+    Expr *target = make_global_ref(cell);
+    Expr *inlined = compile_inline(unit, target, arg, bound, depth);
+    if (inlined == NULL) return NULL;
+    return make_if(make_binop(EQ, func, target), inlined, make_apply(func, arg));
+}
+
+// Adds the free variables of expr that are bound in outer, the scope around
+// the lambda being lifted, to its parameters; inner holds the names bound
+// within it. 0 if there are too many.
+int lift_free_vars(Expr *expr, HashScope *inner, HashScope *outer, Lifted *lifted) {
+    switch (expr->type) {
+        case VAR: {
+            char *var = expr->data.var;
+            if (scope_contains(inner, var) || !scope_contains(outer, var)) return 1;
+            for (int i = 0; i < lifted->count; i++) {
+                if (strcmp(lifted->params[i], var) == 0) return 1;
+            }
+            if (lifted->count == LIFT_MAX_PARAMS) return 0;
+            lifted->params[lifted->count] = var;
+            lifted->args[lifted->count++] = expr;
+            return 1;
+        }
+        case LAMBDA: {
+            HashScope param = { expr->data.lambda.param, inner };
+            return lift_free_vars(expr->data.lambda.body, &param, outer, lifted);
+        }
+        case APPLY:
+            return lift_free_vars(expr->data.apply.func, inner, outer, lifted) &&
+                   lift_free_vars(expr->data.apply.arg, inner, outer, lifted);
+        case LIFTED_CALL:
+            for (int i = 0; i < expr->data.lifted->count; i++) {
+                if (!lift_free_vars(expr->data.lifted->args[i], inner, outer, lifted)) return 0;
+            }
+            return 1;
+        case QUOTE:
+            return 1;
+        case DEFINE:
+            return lift_free_vars(expr->data.apply.arg, inner, outer, lifted);
+        case IF:
+        case BRANCHES:
+            return lift_free_vars(expr->data.binop.left, inner, outer, lifted) &&
+                   lift_free_vars(expr->data.binop.right, inner, outer, lifted);
+        default: {
+            const SpecialForm *form = special_form_of(expr->type);
+            if (form == NULL) return 1;
+            if (form->arity == 1) return lift_free_vars(expr->data.apply.arg, inner, outer, lifted);
+            return lift_free_vars(expr->data.binop.left, inner, outer, lifted) &&
+                   lift_free_vars(expr->data.binop.right, inner, outer, lifted);
+        }
+    }
+}
+
+// Lift ((... (f a1) ...) ak) when f is a lambda written in place, or a
+// curried top-level function and k is at least 2
+Expr *compile_lift(CompiledLambda *unit, Expr *expr, HashScope *bound, int depth) {
+    if (!lift_enabled || depth >= INLINE_MAX_DEPTH) return NULL;
+    Expr *spine[LIFT_MAX_PARAMS];  // Outermost application first
+    int k = 0;
+    Expr *head;
+    for (head = expr; head->type == APPLY; head = head->data.apply.func) {
+        if (k == LIFT_MAX_PARAMS) return NULL;
+        spine[k++] = head;
+    }
+    Lifted lifted = { .count = 0 };
+    Expr *lambda;
+    if (head->type == LAMBDA) {
+        lambda = compile_expr(unit, head, bound, depth);
+        if (!lift_free_vars(lambda, NULL, bound, &lifted)) return NULL;
+        head = lambda;
+    } else {
+        if (head->type != VAR || k < 2 || scope_contains(bound, head->data.var)) return NULL;
+        Environment *cell = global_cell(head->data.var);
+        if (cell == NULL || strcmp(cell->var, unit->name) == 0) return NULL;
+        Expr *callee = cell->value;
+        if (callee->type != CLOSURE || callee->data.closure.env != NULL) return NULL;
+        Expr *source = callee->data.closure.lambda->data.lambda.body;
+        for (CompiledLambda *c = compiled_lambdas; c != NULL; c = c->next) {
+            if (c->lambda == callee->data.closure.lambda) source = c->source;
+        }
+        if (source->type != LAMBDA) return NULL;  // Not curried
+        compiled_add_dep(unit, cell->var);
+        lambda = compile_expr(unit, make_lambda(callee->data.closure.lambda->data.lambda.param, source), NULL, depth + 1);
+        head = make_global_ref(cell);
+    }
+    Expr *body = lambda;
+    for (; k > 0 && body->type == LAMBDA && lifted.count < LIFT_MAX_PARAMS; k--) {
+        Expr *arg = compile_expr(unit, spine[k - 1]->data.apply.arg, bound, depth);
+        lifted.params[lifted.count] = body->data.lambda.param;
+        lifted.args[lifted.count++] = arg;
+        head = make_apply(head, arg);
+        body = body->data.lambda.body;
+    }
+    lifted.body = body;
+    lifted.source = head;
+    lifted_sites++;
+    Expr *call = make_lifted_call(&lifted);
+    for (; k > 0; k--) call = make_apply(call, compile_expr(unit, spine[k - 1]->data.apply.arg, bound, depth));
+    return call;
+}
+
+Expr *compile_expr(CompiledLambda *unit, Expr *expr, HashScope *bound, int depth) {
+    switch (expr->type) {
+        case VAR: {
+            if (scope_contains(bound, expr->data.var)) return expr;
+            Environment *cell = global_cell(expr->data.var);
+            if (cell == NULL) {
+                compiled_add_dep(unit, expr->data.var);  // Recompile once it is defined
+                return expr;
+            }
+            if (cell->value->type == INT_LITERAL || cell->value->type == FLOAT_LITERAL || cell->value->type == BOOLEAN) {
+                compiled_add_dep(unit, expr->data.var);
+                return cell->value;
+            }
+            return make_global_ref(cell);
+        }
+        case LAMBDA: {
+            HashScope param = { expr->data.lambda.param, bound };
+            Expr *body = compile_expr(unit, expr->data.lambda.body, &param, depth);
+            return body == expr->data.lambda.body ? expr : make_lambda(expr->data.lambda.param, body);
+        }
+        case APPLY: {
+            Expr *lifted = compile_lift(unit, expr, bound, depth);
+            if (lifted != NULL) return lifted;
+            Expr *func = compile_expr(unit, expr->data.apply.func, bound, depth);
+            Expr *arg = compile_expr(unit, expr->data.apply.arg, bound, depth);
+            Expr *inlined = compile_inline(unit, func, arg, bound, depth);
+            if (inlined == NULL) inlined = compile_speculate(unit, func, arg, bound, depth);
+            if (inlined != NULL) return inlined;
+            if (func == expr->data.apply.func && arg == expr->data.apply.arg) return expr;
+            return make_apply(func, arg);
+        }
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY:
+        case LESS:
+        case NUM_EQUAL: {
+            Expr *left = compile_expr(unit, expr->data.binop.left, bound, depth);
+            Expr *right = compile_expr(unit, expr->data.binop.right, bound, depth);
+            Number a = number_of(left), b = number_of(right), value;
+            if (expr->type == LESS || expr->type == NUM_EQUAL) {
+                if (a != NUMBER_NONE && b != NUMBER_NONE) return make_boolean(number_compare(expr->type, a, b));
+            } else if (number_arith(expr->type, a, b, &value)) {
+                return number_box(value);  // Errors are left to raise at run time
+            }
+            if (left == expr->data.binop.left && right == expr->data.binop.right) return expr;
+            return make_binop(expr->type, left, right);
+        }
+        case IF: {
+            // The unit's own ifs are numbered in compile order, which is stable across runs
+            int branch = depth == 0 && unit->branch_count < PGO_MAX_BRANCHES ? unit->branch_count++ : -1;
+            Expr *test = compile_expr(unit, expr->data.binop.left, bound, depth);
+            Expr *branches = expr->data.binop.right;
+            if (test->type == BOOLEAN || number_of(test) != NUMBER_NONE) {  // Decided: compile one branch
+                Expr *branch = is_true(test) ? branches->data.binop.left : branches->data.binop.right;
+                return compile_expr(unit, branch, bound, depth);
+            }
+            unsigned long long *seen = branch >= 0 && unit->prior != NULL ? unit->prior->counts.branches[branch] : NULL;
+            int cold_then = seen != NULL && seen[0] == 0 && seen[1] > 0;
+            int cold_else = seen != NULL && seen[1] == 0 && seen[0] > 0;
+            unit->cold += cold_then;
+            Expr *then = compile_expr(unit, branches->data.binop.left, bound, depth);
+            unit->cold += cold_else - cold_then;
+            Expr *otherwise = compile_expr(unit, branches->data.binop.right, bound, depth);
+            unit->cold -= cold_else;
+            int site = branch >= 0 && pgo_path != NULL ? pgo_site(&unit->counts, branch) : 0;
+            if (site == 0 && test == expr->data.binop.left && then == branches->data.binop.left &&
+                otherwise == branches->data.binop.right) {
+                return expr;
+            }
+            Expr *result = make_if(test, then, otherwise);
+            result->site = site;
+            return result;
+        }
+        case QUOTE:
+        case DEFINE:
+            return expr;
+        default: {
+            const SpecialForm *form = special_form_of(expr->type);
+            if (form == NULL) return expr;
+            if (form->arity == 1) {
+                Expr *arg = compile_expr(unit, expr->data.apply.arg, bound, depth);
+                return arg == expr->data.apply.arg ? expr : make_unary(expr->type, arg);
+            }
+            Expr *left = compile_expr(unit, expr->data.binop.left, bound, depth);
+            Expr *right = compile_expr(unit, expr->data.binop.right, bound, depth);
+            if (left == expr->data.binop.left && right == expr->data.binop.right) return expr;
+            return make_binop(expr->type, left, right);
+        }
+    }
+}
+
+// Tracing JIT. Compiled top-level lambda bodies sit behind a TRACE_ANCHOR
+// that counts calls; a curried lambda's anchor sits in front of its
+// innermost body, so the trace starts once the call has all its arguments.
+// Once a lambda is hot, the next call is run by a recorder that follows the
+// path eval would take through APPLY, ADD, SUBTRACT, MULTIPLY and variable
+// references, across calls into other lambdas, and writes it down as a
+// linear trace of typed number operations: fixnum arithmetic stays 32-bit,
+// while float arithmetic, and an int meeting a float, which the trace converts
+// as the interpreter promotes it, runs unboxed in SSE registers. Every global
+// the path read is guarded by identity. An if on < or = continues into the
+// branch taken, behind a compare-and-branch guard that leaves the trace if
+// the comparison would go the other way. A tail call from the lambda back
+// into itself closes a loop: the trace stores the new arguments and jumps
+// back to its head, so a tail-recursive loop runs on trace until a guard
+// fails. The back-edge is a
+// safepoint: every SAFEPOINT_INTERVAL iterations the loop leaves for the
+// interpreter to make one call, so budgets are checked and a runaway loop
+// still ends at the recursion limit, if SAFEPOINT_INTERVAL times later than
+// in the interpreter, which nests a call per iteration. Other calls,
+// recursive ones included, are followed into and inlined up to
+// TRACE_MAX_DEPTH. The trace is compiled to x86-64 and later calls run it
+// directly when each argument has the type, int or float, that it had while
+// recording; that check is the trace's float guard, and within the trace
+// every value's type is then known. Traces are pure, so a failed guard (a
+// side exit) resumes the interpreter at the lambda's entry, with the
+// arguments of the iteration it left, and nothing to undo. Only top-level
+// lambdas of number arguments are anchored; a path that leaves this fragment
+// aborts recording.
+#define JIT_HOT_CALLS 64         // Calls before a lambda's first recording
+#define TRACE_MAX_OPS 256
+#define TRACE_MAX_ARGS 8         // Parameters of a curried lambda that can be anchored
+#define TRACE_MAX_DEPTH 32       // Calls followed into while recording
+#define TRACE_MAX_SIDE_EXITS 64  // Before a trace is dropped and re-recorded, or backed off if it mostly exits
+#define TRACE_MAX_ABORTS 3       // Before a lambda stops being recorded
+
+// Kinds from TRACE_FLOAT on read two operand ops; TRACE_LESS and
+// TRACE_EQUAL are compare-and-branch guards and produce no value.
+// TRACE_FLOAT converts an int op to a double, and it and TRACE_LOOP name
+// their one operand in left and right both. TRACE_LOOP stores it as the
+// next iteration's argument; a loop's trace ends with one for each argument
+// and then jumps back to its head. Operands of an op have the same type.
+typedef enum {
+    TRACE_ARG, TRACE_CONST, TRACE_GUARD, TRACE_FLOAT, TRACE_ADD, TRACE_SUB, TRACE_MUL, TRACE_LESS, TRACE_EQUAL, TRACE_LOOP
+} TraceOpKind;
+
+typedef struct {
+    TraceOpKind kind;
+    int left, right;     // Operand ops, or TRACE_ARG's argument position in left
+    int value;           // TRACE_CONST, the argument TRACE_ARG saw while recording, the outcome a branch requires,
+                         // or the argument position TRACE_LOOP stores
+    Expr **cell;         // TRACE_GUARD: *cell must still be expected
+    Expr *expected;
+    int flonum;          // The value is a double; for a branch, its operands are
+    double float_value;  // In place of value for a double
+} TraceOp;
+
+int trace_reads_operands(TraceOpKind kind) {
+    return kind >= TRACE_FLOAT;
+}
+
+int trace_is_branch(TraceOpKind kind) {
+    return kind == TRACE_LESS || kind == TRACE_EQUAL;
+}
+
+// Arguments are passed outermost parameter first, an int in the low half of
+// its word and a double as its bits; a side exit leaves them as the
+// iteration it left from saw them. The result is returned the same way. A
+// loop is passed the iterations it may run in *result, and counts them down.
+typedef int (*TraceCode)(uint64_t *args, uint64_t *result);  // Nonzero return is a side exit
+
+typedef struct Trace {
+    Expr *body;     // What the anchor stands in front of
+    int arity;      // Parameters of the curried lambda, innermost last
+    int flonums;    // Bit per argument position that was a float while recording
+    int countdown;  // Calls left until the next recording
+    int aborts;
+    int side_exits;
+    TraceOp *ops;
+    int op_count;
+    int result;     // Op holding the trace's value, or -1 if it closes a loop
+    TraceCode code;
+    size_t code_size;
+    int runs;       // Native runs, counted until the trace is optimized
+    int optimized;
+    Expr **callees;  // Lambdas whose bodies the trace recorded calls into
+    int callee_count;
+} Trace;
+
+static int jit_enabled = 1;
+static unsigned long long jit_traces, jit_loops, jit_side_exits, jit_optimized;
+
+// A value while recording: an integer op or a closure known to the trace
+typedef struct TraceBinding TraceBinding;
+
+typedef struct {
+    int op;        // -1 for a closure
+    Number value;  // Seen while recording
+    Expr *lambda;
+    TraceBinding *bindings;  // Parameters the trace bound
+    Environment *env;        // Environment the closure had before the trace
+    Expr *closure;           // The closure itself if it existed before the trace
+} TraceValue;
+
+struct TraceBinding {
+    char *var;
+    TraceValue value;
+    TraceBinding *next;
+};
+
+typedef struct {
+    TraceOp ops[TRACE_MAX_OPS];
+    int count;
+    TraceBinding bindings[TRACE_MAX_OPS];  // Closures made while recording may outlive a call
+    int binding_count;
+    int depth;
+    Expr *anchor;       // Being recorded
+    Environment *base;  // The anchored lambda's environment, outside its parameters
+    Expr *tail;         // The expression in tail position of the anchor's body, at depth 0
+    int looped;
+    Expr *callees[TRACE_MAX_OPS];
+    int callee_count;
+    jmp_buf abort;
+} TraceRecorder;
+
+Expr *make_trace_anchor(Expr *body, int hot, int arity) {
+    Trace *trace = calloc(1, sizeof(Trace));
+    trace->body = body;
+    trace->arity = arity;
+    trace->countdown = hot ? 1 : JIT_HOT_CALLS;
+    Expr *expr = scheme_alloc(sizeof(Expr));
+    expr->type = TRACE_ANCHOR;
+    expr->data.trace = trace;
+    return expr;
+}
+
+Expr *trace_body(Expr *anchor) {
+    return anchor->data.trace->body;
+}
+
+TraceValue trace_op(TraceRecorder *rec, TraceOp op, Number value) {
+    if (rec->count == TRACE_MAX_OPS) longjmp(rec->abort, 1);
+    rec->ops[rec->count] = op;
+    TraceValue result = { rec->count++, value, NULL, NULL, NULL, NULL };
+    return result;
+}
+
+TraceValue trace_const(TraceRecorder *rec, Number value) {
+    TraceOp op = { TRACE_CONST, 0, 0, 0, NULL, NULL, !number_is_int(value), 0 };
+    if (op.flonum) op.float_value = number_to_double(value);
+    else op.value = (int32_t)value;
+    return trace_op(rec, op, value);
+}
+
+// Bring an int and a double operand to one type, converting the int as the
+// interpreter promotes it
+void trace_promote(TraceRecorder *rec, TraceValue *left, TraceValue *right) {
+    if (number_is_int(left->value) == number_is_int(right->value)) return;
+    TraceValue *value = number_is_int(left->value) ? left : right;
+    Number converted = number_double((int32_t)value->value);
+    if (rec->ops[value->op].kind == TRACE_CONST) {
+        *value = trace_const(rec, converted);
+    } else {
+        TraceOp op = { TRACE_FLOAT, value->op, value->op, 0, NULL, NULL, 1, 0 };
+        *value = trace_op(rec, op, converted);
+    }
+}
+
+// A value that cannot change while the guards hold
+TraceValue trace_known(TraceRecorder *rec, Expr *value) {
+    if (value->type == INT_LITERAL || value->type == FLOAT_LITERAL) return trace_const(rec, number_of(value));
+    if (value->type != CLOSURE) longjmp(rec->abort, 1);
+    TraceValue closure = { -1, 0, value->data.closure.lambda, NULL, value->data.closure.env, value };
+    return closure;
+}
+
+TraceValue trace_global(TraceRecorder *rec, Environment *cell) {
+    if (cell == NULL || cell->value == NULL) longjmp(rec->abort, 1);
+    int guarded = 0;
+    for (int i = 0; i < rec->count; i++) {
+        if (rec->ops[i].kind == TRACE_GUARD && rec->ops[i].cell == &cell->value) guarded = 1;
+    }
+    if (!guarded) {
+        TraceOp op = { TRACE_GUARD, 0, 0, 0, &cell->value, cell->value, 0, 0 };
+        trace_op(rec, op, 0);
+    }
+    return trace_known(rec, cell->value);
+}
+
+// The trace copies lambda's body, and is stale once the body is recompiled
+void trace_callee(TraceRecorder *rec, Expr *lambda) {
+    for (int i = 0; i < rec->callee_count; i++) {
+        if (rec->callees[i] == lambda) return;
+    }
+    if (rec->callee_count == TRACE_MAX_OPS) longjmp(rec->abort, 1);
+    rec->callees[rec->callee_count++] = lambda;
+}
+
+// The branch an if takes, which is in tail position if the if was
+Expr *trace_branch(TraceRecorder *rec, Expr *expr, int taken) {
+    Expr *branches = expr->data.binop.right;
+    Expr *branch = taken ? branches->data.binop.left : branches->data.binop.right;
+    if (rec->depth == 0 && expr == rec->tail) rec->tail = branch;
+    return branch;
+}
+
+// A tail call that re-enters the anchored lambda with arguments of the types
+// it was entered with, in the environment it was entered with, ends the trace
+// in a loop back to its head. Only closures the trace made itself can hold
+// the outer arguments.
+int trace_close_loop(TraceRecorder *rec, TraceValue func, TraceValue arg) {
+    if (func.op >= 0 || func.lambda->data.lambda.body != rec->anchor || func.env != rec->base || arg.op < 0) return 0;
+    Trace *trace = rec->anchor->data.trace;
+    int arity = trace->arity;
+    int args[TRACE_MAX_ARGS];
+    args[arity - 1] = arg.op;
+    TraceBinding *b = func.bindings;
+    for (int position = arity - 2; position >= 0; position--, b = b->next) {
+        if (b == NULL || b->value.op < 0) return 0;
+        args[position] = b->value.op;
+    }
+    if (b != NULL) return 0;
+    for (int position = 0; position < arity; position++) {
+        if (rec->ops[args[position]].flonum != (trace->flonums >> position & 1)) return 0;
+    }
+    for (int position = 0; position < arity; position++) {
+        TraceOp op = { TRACE_LOOP, args[position], args[position], position, NULL, NULL, rec->ops[args[position]].flonum, 0 };
+        trace_op(rec, op, 0);
+    }
+    rec->looped = 1;
+    return 1;
+}
+
+TraceValue trace_record(TraceRecorder *rec, Expr *expr, TraceBinding *bindings, Environment *env) {
+    switch (base_type(expr->type)) {
+        case INT_LITERAL:
+        case FLOAT_LITERAL:
+            return trace_const(rec, number_of(expr));
+        case VAR: {
+            for (TraceBinding *b = bindings; b != NULL; b = b->next) {
+                if (strcmp(b->var, expr->data.var) == 0) return b->value;
+            }
+            Expr *value = env_lookup(env, expr->data.var);
+            if (value != NULL) return trace_known(rec, value);
+            return trace_global(rec, global_cell(expr->data.var));
+        }
+        case GLOBAL_REF:
+            return trace_global(rec, expr->data.global);
+        case LAMBDA: {
+            TraceValue closure = { -1, 0, expr, bindings, env, NULL };
+            return closure;
+        }
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY: {
+            ExprType type = base_type(expr->type);
+            TraceValue left = trace_record(rec, expr->data.binop.left, bindings, env);
+            TraceValue right = trace_record(rec, expr->data.binop.right, bindings, env);
+            Number value;
+            if (left.op < 0 || right.op < 0 || !number_arith(type, left.value, right.value, &value)) {
+                longjmp(rec->abort, 1);  // The interpreter raises the overflow
+            }
+            trace_promote(rec, &left, &right);
+            if (rec->ops[left.op].kind == TRACE_CONST && rec->ops[right.op].kind == TRACE_CONST) {
+                return trace_const(rec, value);
+            }
+            TraceOpKind kind = type == ADD ? TRACE_ADD : type == SUBTRACT ? TRACE_SUB : TRACE_MUL;
+            TraceOp op = { kind, left.op, right.op, 0, NULL, NULL, !number_is_int(value), 0 };
+            return trace_op(rec, op, value);
+        }
+        case IF: {
+            Expr *test = expr->data.binop.left;
+            if (test->type == EQ) {  // A speculated call: closures known to the trace are fixed by its guards
+                TraceValue left = trace_record(rec, test->data.binop.left, bindings, env);
+                TraceValue right = trace_record(rec, test->data.binop.right, bindings, env);
+                if (left.closure == NULL || right.closure == NULL) longjmp(rec->abort, 1);
+                int taken = left.closure == right.closure;
+                return trace_record(rec, trace_branch(rec, expr, taken), bindings, env);
+            }
+            if (test->type != LESS && test->type != NUM_EQUAL) longjmp(rec->abort, 1);
+            TraceValue left = trace_record(rec, test->data.binop.left, bindings, env);
+            TraceValue right = trace_record(rec, test->data.binop.right, bindings, env);
+            if (left.op < 0 || right.op < 0) longjmp(rec->abort, 1);
+            int taken = number_compare(test->type, left.value, right.value);
+            trace_promote(rec, &left, &right);
+            if (rec->ops[left.op].kind != TRACE_CONST || rec->ops[right.op].kind != TRACE_CONST) {
+                TraceOp op = { test->type == LESS ? TRACE_LESS : TRACE_EQUAL, left.op, right.op, taken, NULL, NULL,
+                               !number_is_int(left.value), 0 };
+                trace_op(rec, op, 0);
+            }
+            return trace_record(rec, trace_branch(rec, expr, taken), bindings, env);
+        }
+        case APPLY: {
+            TraceValue func = trace_record(rec, expr->data.apply.func, bindings, env);
+            TraceValue arg = trace_record(rec, expr->data.apply.arg, bindings, env);
+            if (rec->depth == 0 && expr == rec->tail && trace_close_loop(rec, func, arg)) return arg;
+            if (func.op >= 0 || rec->depth == TRACE_MAX_DEPTH || rec->binding_count == TRACE_MAX_OPS) {
+                longjmp(rec->abort, 1);
+            }
+            trace_callee(rec, func.lambda);
+            TraceBinding *param = &rec->bindings[rec->binding_count++];
+            param->var = func.lambda->data.lambda.param;
+            param->value = arg;
+            param->next = func.bindings;
+            rec->depth++;
+            TraceValue result = trace_record(rec, func.lambda->data.lambda.body, param, func.env);
+            rec->depth--;
+            return result;
+        }
+        case LIFTED_CALL: {
+            Lifted *lifted = expr->data.lifted;
+            TraceBinding *frame = NULL;
+            for (int i = 0; i < lifted->count; i++) {
+                TraceValue arg = trace_record(rec, lifted->args[i], bindings, env);
+                if (rec->binding_count == TRACE_MAX_OPS) longjmp(rec->abort, 1);
+                TraceBinding *param = &rec->bindings[rec->binding_count++];
+                param->var = lifted->params[i];
+                param->value = arg;
+                param->next = frame;
+                frame = param;
+            }
+            if (rec->depth == TRACE_MAX_DEPTH) longjmp(rec->abort, 1);
+            rec->depth++;
+            TraceValue result = trace_record(rec, lifted->body, frame, NULL);
+            rec->depth--;
+            return result;
+        }
+        case TRACE_ANCHOR:
+            return trace_record(rec, expr->data.trace->body, bindings, env);
+        default:
+            longjmp(rec->abort, 1);
+    }
+}
+
+// Range analysis. Traced +, - and * of ints run as 32-bit machine arithmetic,
+// and an overflow must leave through a side exit so that the interpreter
+// raises it; float ops cannot fail and are left out.
+// Rather than a jo after every op, the value range of each op is computed
+// for arguments within [-bound, bound], and bisection finds the widest bound
+// that still covers the arguments seen while recording and under which no op
+// can overflow. A guard on each argument where the trace, or a loop
+// iteration, loads it then stands in for all the checks. If even the
+// recorded arguments are too wide, the ops whose ranges may not fit keep
+// their own jo. Ops after a branch guard only see operands that passed it,
+// so a counter tested against a limit is bounded by the limit from there on.
+typedef struct {
+    long long lo, hi;
+} Range;
+
+// Narrow the operand ranges of a branch guard to the values that pass it
+void range_narrow(Range *range, TraceOp *op) {
+    Range *a = &range[op->left], *b = &range[op->right];
+    if (op->kind == TRACE_EQUAL) {
+        if (!op->value) return;
+        if (a->lo < b->lo) a->lo = b->lo;
+        else b->lo = a->lo;
+        if (a->hi > b->hi) a->hi = b->hi;
+        else b->hi = a->hi;
+    } else if (op->value) {  // a < b
+        if (a->hi > b->hi - 1) a->hi = b->hi - 1;
+        if (b->lo < a->lo + 1) b->lo = a->lo + 1;
+    } else {  // a >= b
+        if (a->lo < b->lo) a->lo = b->lo;
+        if (b->hi > a->hi) b->hi = a->hi;
+    }
+}
+
+// 1 if no op can overflow for an argument in [-bound, bound]; check marks the ops that might
+int trace_ranges(TraceOp *ops, int count, long long bound, unsigned char *check) {
+    Range range[TRACE_MAX_OPS];
+    int safe = 1;
+    for (int i = 0; i < count; i++) {
+        TraceOp *op = &ops[i];
+        Range a, b;
+        if (op->flonum) {
+            range[i] = (Range){ 0, 0 };
+            check[i] = 0;
+            continue;
+        }
+        switch (op->kind) {
+            case TRACE_ARG:
+                range[i] = (Range){ bound > -(long long)INT_MIN ? INT_MIN : -bound, bound > INT_MAX ? INT_MAX : bound };
+                break;
+            case TRACE_CONST:
+                range[i] = (Range){ op->value, op->value };
+                break;
+            case TRACE_GUARD:
+            case TRACE_FLOAT:
+            case TRACE_LOOP:
+                range[i] = (Range){ 0, 0 };
+                break;
+            case TRACE_LESS:
+            case TRACE_EQUAL:
+                range[i] = (Range){ 0, 0 };
+                range_narrow(range, op);
+                break;
+            case TRACE_ADD:
+                a = range[op->left], b = range[op->right];
+                range[i] = (Range){ a.lo + b.lo, a.hi + b.hi };
+                break;
+            case TRACE_SUB:
+                a = range[op->left], b = range[op->right];
+                range[i] = (Range){ a.lo - b.hi, a.hi - b.lo };
+                break;
+            case TRACE_MUL: {
+                a = range[op->left], b = range[op->right];
+                long long corners[4] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+                range[i] = (Range){ corners[0], corners[0] };
+                for (int c = 1; c < 4; c++) {
+                    if (corners[c] < range[i].lo) range[i].lo = corners[c];
+                    if (corners[c] > range[i].hi) range[i].hi = corners[c];
+                }
+                break;
+            }
+        }
+        check[i] = range[i].lo < INT_MIN || range[i].hi > INT_MAX;
+        if (check[i]) {
+            safe = 0;
+            range[i] = (Range){ INT_MIN, INT_MAX };  // What gets past the check
+        }
+    }
+    return safe;
+}
+
+// Bound for the argument guards, above INT_MAX if none is needed, or -1 if
+// the ops marked in check need their own
+long long trace_bound(TraceOp *ops, int count, unsigned char *check) {
+    long long seen = 0;
+    for (int i = 0; i < count; i++) {
+        if (ops[i].kind == TRACE_ARG && !ops[i].flonum && llabs(ops[i].value) > seen) seen = llabs(ops[i].value);
+    }
+    long long lo = seen, hi = (long long)INT_MAX + 1;
+    if (!trace_ranges(ops, count, lo, check)) {
+        trace_ranges(ops, count, hi, check);
+        return -1;
+    }
+    while (lo < hi) {  // lo is safe; find the largest safe bound
+        long long mid = lo + (hi - lo + 1) / 2;
+        if (trace_ranges(ops, count, mid, check)) lo = mid;
+        else hi = mid - 1;
+    }
+    trace_ranges(ops, count, lo, check);
+    return lo;
+}
+
+#if defined(__x86_64__)
+enum { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7, R8 = 8, R9 = 9, R10 = 10, R11 = 11 };
+
+typedef struct {
+    unsigned char bytes[TRACE_MAX_OPS * 40 + 64];
+    size_t length;
+} CodeBuffer;
+
+void emit(CodeBuffer *code, const unsigned char *bytes, size_t length) {
+    memcpy(code->bytes + code->length, bytes, length);
+    code->length += length;
+}
+
+void emit_u32(CodeBuffer *code, uint32_t value) {
+    emit(code, (unsigned char *)&value, 4);
+}
+
+void emit_u64(CodeBuffer *code, uint64_t value) {
+    emit(code, (unsigned char *)&value, 8);
+}
+
+void emit_byte(CodeBuffer *code, unsigned char byte) {
+    code->bytes[code->length++] = byte;
+}
+
+void emit_rex(CodeBuffer *code, int reg, int rm) {
+    if (reg >= 8 || rm >= 8) emit_byte(code, 0x40 | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0));
+}
+
+// Jump with a 2-byte opcode to the side exit, patched once it is placed
+void emit_exit_jump(CodeBuffer *code, const unsigned char *opcode, size_t *exits, int *exit_count) {
+    emit(code, opcode, 2);
+    exits[(*exit_count)++] = code->length;
+    emit_u32(code, 0);
+}
+
+// Second opcode byte of the jcc that leaves when a compare of left with
+// right, just made, goes the way the branch guard excludes
+unsigned char branch_exit_condition(TraceOp *op) {
+    if (op->kind == TRACE_LESS) return op->value ? 0x8d : 0x8c;  // jge : jl
+    return op->value ? 0x85 : 0x84;  // jne : je
+}
+
+// Side exit unless the argument just loaded into reg is within [-bound, bound]
+void emit_arg_guard(CodeBuffer *code, int reg, long long bound, size_t *exits, int *exit_count) {
+    if (bound < 0 || bound > INT_MAX) return;
+    emit_rex(code, 0, reg);
+    emit(code, (unsigned char[]){ 0x81, 0xf8 | (reg & 7) }, 2);  // cmp r32, -bound
+    emit_u32(code, (uint32_t)-bound);
+    emit_exit_jump(code, (unsigned char[]){ 0x0f, 0x8c }, exits, exit_count);  // jl exit
+    emit_rex(code, 0, reg);
+    emit(code, (unsigned char[]){ 0x81, 0xf8 | (reg & 7) }, 2);  // cmp r32, bound
+    emit_u32(code, (uint32_t)bound);
+    emit_exit_jump(code, (unsigned char[]){ 0x0f, 0x8f }, exits, exit_count);  // jg exit
+}
+
+// opcode with reg and the int argument at position in the array rdi points
+// to: 0x8b loads it, 0x89 stores it
+void emit_arg(CodeBuffer *code, unsigned char opcode, int reg, int position) {
+    emit_rex(code, reg, 0);
+    emit(code, (unsigned char[]){ opcode, 0x87 | (reg & 7) << 3 }, 2);  // [rdi + disp32]
+    emit_u32(code, (uint32_t)(8 * position));
+}
+
+// movsd with xmm and the float argument at position: 0x10 loads it, 0x11
+// stores it
+void emit_float_arg(CodeBuffer *code, unsigned char opcode, int xmm, int position) {
+    emit_byte(code, 0xf2);
+    emit_rex(code, xmm, 0);
+    emit(code, (unsigned char[]){ 0x0f, opcode, 0x87 | (xmm & 7) << 3 }, 3);  // [rdi + disp32]
+    emit_u32(code, (uint32_t)(8 * position));
+}
+
+// Second opcode byte of addsd, subsd or mulsd
+unsigned char float_arith_opcode(TraceOpKind kind) {
+    return kind == TRACE_ADD ? 0x58 : kind == TRACE_SUB ? 0x5c : 0x59;
+}
+
+// A float branch guard compares its operands with ucomisd, right first for
+// <: a < b is b above a, which leaves out unordered operands as < does
+int float_branch_swaps(TraceOp *op) {
+    return op->kind == TRACE_LESS;
+}
+
+// Jumps to the side exit after that ucomisd, for the outcome the guard
+// excludes. An unordered compare sets ZF too, so = also tests PF.
+void emit_float_branch_exit(CodeBuffer *code, TraceOp *op, size_t *exits, int *exit_count) {
+    if (op->kind == TRACE_LESS) {
+        emit_exit_jump(code, (unsigned char[]){ 0x0f, op->value ? 0x86 : 0x87 }, exits, exit_count);  // jbe : ja
+    } else if (op->value) {
+        emit_exit_jump(code, (unsigned char[]){ 0x0f, 0x85 }, exits, exit_count);  // jne exit
+        emit_exit_jump(code, (unsigned char[]){ 0x0f, 0x8a }, exits, exit_count);  // jp exit
+    } else {
+        emit(code, (unsigned char[]){ 0x7a, 0x06 }, 2);  // jp past the je
+        emit_exit_jump(code, (unsigned char[]){ 0x0f, 0x84 }, exits, exit_count);  // je exit
+    }
+}
+
+// Back to the head of a loop's trace at offset head while it has iterations
+// left, else fall through into the side exit placed next
+void emit_loop_jump(CodeBuffer *code, size_t head) {
+    emit(code, (unsigned char[]){ 0xff, 0x0e, 0x0f, 0x85 }, 4);  // dec dword [rsi]; jnz head
+    emit_u32(code, (uint32_t)(head - (code->length + 4)));
+}
+
+// opcode bytes, then a [rbp + disp32] operand for frame slot i
+void emit_slot(CodeBuffer *code, const unsigned char *opcode, size_t length, int slot) {
+    emit(code, opcode, length);
+    emit_u32(code, (uint32_t)(-8 * (slot + 1)));
+}
+
+// Copy generated code into memory that is executable but no longer writable
+TraceCode code_install(CodeBuffer *code, size_t *size) {
+    void *memory = mmap(NULL, code->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return NULL;
+    memcpy(memory, code->bytes, code->length);
+    if (mprotect(memory, code->length, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, code->length);
+        return NULL;
+    }
+    *size = code->length;
+    return (TraceCode)memory;
+}
+
+// Template code generation: every op's value lives in its own frame slot,
+// an int in its low half
+TraceCode trace_compile(TraceOp *ops, int count, int result, size_t *size) {
+    CodeBuffer code = { .length = 0 };
+    size_t exits[2 * TRACE_MAX_OPS];  // At most two per op
+    int exit_count = 0;
+    unsigned char check[TRACE_MAX_OPS];
+    long long bound = trace_bound(ops, count, check);
+    emit(&code, (unsigned char[]){ 0x55, 0x48, 0x89, 0xe5, 0x48, 0x81, 0xec }, 7);  // push rbp; mov rbp, rsp; sub rsp, imm32
+    emit_u32(&code, (uint32_t)((8 * count + 15) & ~15));
+    size_t head = code.length;
+    for (int i = 0; i < count; i++) {
+        TraceOp *op = &ops[i];
+        switch (op->kind) {
+            case TRACE_ARG:
+                if (op->flonum) {
+                    emit_float_arg(&code, 0x10, 0, op->left);  // movsd xmm0, [argument]
+                    emit_slot(&code, (unsigned char[]){ 0xf2, 0x0f, 0x11, 0x85 }, 4, i);  // movsd [slot], xmm0
+                    break;
+                }
+                emit_arg(&code, 0x8b, RAX, op->left);  // mov eax, [argument]
+                emit_arg_guard(&code, RAX, bound, exits, &exit_count);
+                emit_slot(&code, (unsigned char[]){ 0x89, 0x85 }, 2, i);  // mov [slot], eax
+                break;
+            case TRACE_LOOP:
+                if (op->flonum) {
+                    emit_slot(&code, (unsigned char[]){ 0xf2, 0x0f, 0x10, 0x85 }, 4, op->left);  // movsd xmm0, [left]
+                    emit_float_arg(&code, 0x11, 0, op->value);  // movsd [argument], xmm0
+                    break;
+                }
+                emit_slot(&code, (unsigned char[]){ 0x8b, 0x85 }, 2, op->left);  // mov eax, [left]
+                emit_arg(&code, 0x89, RAX, op->value);  // mov [argument], eax
+                break;
+            case TRACE_CONST:
+                if (op->flonum) {
+                    uint64_t bits;
+                    memcpy(&bits, &op->float_value, sizeof(bits));
+                    emit(&code, (unsigned char[]){ 0x48, 0xb8 }, 2);  // mov rax, imm64
+                    emit_u64(&code, bits);
+                    emit_slot(&code, (unsigned char[]){ 0x48, 0x89, 0x85 }, 3, i);  // mov [slot], rax
+                    break;
+                }
+                emit_slot(&code, (unsigned char[]){ 0xc7, 0x85 }, 2, i);  // mov dword [slot], imm32
+                emit_u32(&code, (uint32_t)op->value);
+                break;
+            case TRACE_FLOAT:
+                emit_slot(&code, (unsigned char[]){ 0xf2, 0x0f, 0x2a, 0x85 }, 4, op->left);  // cvtsi2sd xmm0, dword [left]
+                emit_slot(&code, (unsigned char[]){ 0xf2, 0x0f, 0x11, 0x85 }, 4, i);  // movsd [slot], xmm0
+                break;
+            case TRACE_LESS:
+            case TRACE_EQUAL:
+                if (op->flonum) {
+                    int swaps = float_branch_swaps(op);
+                    emit_slot(&code, (unsigned char[]){ 0xf2, 0x0f, 0x10, 0x85 }, 4, swaps ? op->right : op->left);  // movsd xmm0, [first]
+                    emit_slot(&code, (unsigned char[]){ 0x66, 0x0f, 0x2e, 0x85 }, 4, swaps ? op->left : op->right);  // ucomisd xmm0, [second]
+                    emit_float_branch_exit(&code, op, exits, &exit_count);
+                    break;
+                }
+                emit_slot(&code, (unsigned char[]){ 0x8b, 0x85 }, 2, op->left);  // mov eax, [left]
+                emit_slot(&code, (unsigned char[]){ 0x3b, 0x85 }, 2, op->right);  // cmp eax, [right]
+                emit_exit_jump(&code, (unsigned char[]){ 0x0f, branch_exit_condition(op) }, exits, &exit_count);
+                break;
+            case TRACE_ADD:
+            case TRACE_SUB:
+            case TRACE_MUL:
+                if (op->flonum) {
+                    emit_slot(&code, (unsigned char[]){ 0xf2, 0x0f, 0x10, 0x85 }, 4, op->left);  // movsd xmm0, [left]
+                    emit_slot(&code, (unsigned char[]){ 0xf2, 0x0f, float_arith_opcode(op->kind), 0x85 }, 4, op->right);  // addsd/subsd/mulsd xmm0, [right]
+                    emit_slot(&code, (unsigned char[]){ 0xf2, 0x0f, 0x11, 0x85 }, 4, i);  // movsd [slot], xmm0
+                    break;
+                }
+                emit_slot(&code, (unsigned char[]){ 0x8b, 0x85 }, 2, op->left);  // mov eax, [left]
+                if (op->kind == TRACE_ADD) emit_slot(&code, (unsigned char[]){ 0x03, 0x85 }, 2, op->right);  // add eax, [right]
+                else if (op->kind == TRACE_SUB) emit_slot(&code, (unsigned char[]){ 0x2b, 0x85 }, 2, op->right);  // sub eax, [right]
+                else emit_slot(&code, (unsigned char[]){ 0x0f, 0xaf, 0x85 }, 3, op->right);  // imul eax, [right]
+                if (check[i]) emit_exit_jump(&code, (unsigned char[]){ 0x0f, 0x80 }, exits, &exit_count);  // jo exit
+                emit_slot(&code, (unsigned char[]){ 0x89, 0x85 }, 2, i);  // mov [slot], eax
+                break;
+            case TRACE_GUARD:
+                emit(&code, (unsigned char[]){ 0x48, 0xb8 }, 2);  // mov rax, cell
+                emit_u64(&code, (uint64_t)(uintptr_t)op->cell);
+                emit(&code, (unsigned char[]){ 0x48, 0x8b, 0x00, 0x48, 0xb9 }, 5);  // mov rax, [rax]; mov rcx, expected
+                emit_u64(&code, (uint64_t)(uintptr_t)op->expected);
+                emit(&code, (unsigned char[]){ 0x48, 0x39, 0xc8 }, 3);  // cmp rax, rcx
+                emit_exit_jump(&code, (unsigned char[]){ 0x0f, 0x85 }, exits, &exit_count);  // jne exit
+                break;
+        }
+    }
+    if (result < 0) {
+        emit_loop_jump(&code, head);
+    } else if (ops[result].flonum) {
+        emit_slot(&code, (unsigned char[]){ 0xf2, 0x0f, 0x10, 0x85 }, 4, result);  // movsd xmm0, [result]
+        emit(&code, (unsigned char[]){ 0xf2, 0x0f, 0x11, 0x06, 0x31, 0xc0, 0xc9, 0xc3 }, 8);  // movsd [rsi], xmm0; xor eax, eax; leave; ret
+    } else {
+        emit_slot(&code, (unsigned char[]){ 0x8b, 0x85 }, 2, result);  // mov eax, [result]
+        emit(&code, (unsigned char[]){ 0x89, 0x06, 0x31, 0xc0, 0xc9, 0xc3 }, 6);  // mov [rsi], eax; xor eax, eax; leave; ret
+    }
+    size_t side_exit = code.length;
+    emit(&code, (unsigned char[]){ 0xb8, 0x01, 0x00, 0x00, 0x00, 0xc9, 0xc3 }, 7);  // mov eax, 1; leave; ret
+    for (int i = 0; i < exit_count; i++) {
+        uint32_t rel = (uint32_t)(side_exit - (exits[i] + 4));
+        memcpy(code.bytes + exits[i], &rel, 4);
+    }
+    return code_install(&code, size);
+}
+#else
+TraceCode trace_compile(TraceOp *ops, int count, int result, size_t *size) {
+    (void)ops, (void)count, (void)result, (void)size;
+    return NULL;  // No code generator for this architecture
+}
+#endif
+
+// Optimizing tier. A trace that stays hot is recompiled from its SSA ops:
+// global guards are hoisted to the entry (branch guards stay after the ops
+// they compare), algebraic identities are simplified, common subexpressions
+// shared and dead ops dropped, unless they may overflow. The values left get
+// registers by linear scan over their live intervals, spilling the interval
+// that ends last to a frame slot only when registers run out, and each op is
+// selected to an instruction with register, frame slot or immediate operands.
+#define OPT_HOT_CALLS 1000  // Native runs of a trace before it is optimized
+
+// op, a TRACE_CONST, shared with an equal one already in out
+int opt_const(TraceOp *out, int *count, TraceOp op) {
+    for (int i = 0; i < *count; i++) {
+        if (out[i].kind == TRACE_CONST && out[i].flonum == op.flonum && out[i].value == op.value &&
+            memcmp(&out[i].float_value, &op.float_value, sizeof(double)) == 0) return i;
+    }
+    out[*count] = op;
+    return (*count)++;
+}
+
+// Rewrite ops into out, guards first; returns the new op count. A loop's
+// trace has no result.
+int opt_simplify(TraceOp *ops, int count, int result, TraceOp *out, int *out_result) {
+    int map[TRACE_MAX_OPS] = { 0 };
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if (ops[i].kind == TRACE_GUARD) out[n++] = ops[i];
+    }
+    for (int i = 0; i < count; i++) {
+        TraceOp op = ops[i];
+        switch (op.kind) {
+            case TRACE_GUARD:
+                continue;
+            case TRACE_ARG:
+                out[n] = op;
+                map[i] = n++;
+                continue;
+            case TRACE_CONST:
+                map[i] = opt_const(out, &n, op);
+                continue;
+            case TRACE_FLOAT: {
+                op.left = op.right = map[op.left];
+                if (out[op.left].kind == TRACE_CONST) {
+                    TraceOp converted = { TRACE_CONST, 0, 0, 0, NULL, NULL, 1, out[op.left].value };
+                    map[i] = opt_const(out, &n, converted);
+                    continue;
+                }
+                int j;
+                for (j = 0; j < n && !(out[j].kind == TRACE_FLOAT && out[j].left == op.left); j++) {}
+                if (j == n) out[n++] = op;
+                map[i] = j;
+                continue;
+            }
+            case TRACE_LESS:
+            case TRACE_EQUAL:
+                op.left = map[op.left];
+                op.right = map[op.right];
+                if (out[op.left].kind == TRACE_CONST && out[op.right].kind == TRACE_CONST) continue;  // Always passes
+                out[n++] = op;
+                continue;
+            case TRACE_LOOP:
+                op.left = op.right = map[op.left];
+                out[n++] = op;
+                continue;
+            case TRACE_ADD:
+            case TRACE_SUB:
+            case TRACE_MUL:
+                break;
+        }
+        ExprType type = op.kind == TRACE_ADD ? ADD : op.kind == TRACE_SUB ? SUBTRACT : MULTIPLY;
+        int commutes = op.kind != TRACE_SUB;
+        int left = map[op.left], right = map[op.right];
+        if (commutes && out[left].kind == TRACE_CONST) {  // Constants to the right
+            int swap = left;
+            left = right;
+            right = swap;
+        }
+        if (op.flonum) {
+            // Only folded: x + 0.0 is not x for x = -0.0, nor x * 0.0 zero for infinities
+            if (out[left].kind == TRACE_CONST && out[right].kind == TRACE_CONST) {
+                double x = out[left].float_value, y = out[right].float_value;
+                TraceOp folded = { TRACE_CONST, 0, 0, 0, NULL, NULL, 1,
+                                   op.kind == TRACE_ADD ? x + y : op.kind == TRACE_SUB ? x - y : x * y };
+                map[i] = opt_const(out, &n, folded);
+                continue;
+            }
+        } else if (out[right].kind == TRACE_CONST) {
+            int k = out[right].value;
+            int value;
+            if (out[left].kind == TRACE_CONST && !int_overflows(type, out[left].value, k, &value)) {
+                TraceOp folded = { TRACE_CONST, 0, 0, value, NULL, NULL, 0, 0 };
+                map[i] = opt_const(out, &n, folded);
+                continue;
+            }
+            if ((op.kind != TRACE_MUL && k == 0) || (op.kind == TRACE_MUL && k == 1)) {
+                map[i] = left;
+                continue;
+            }
+            if (op.kind == TRACE_MUL && k == 0) {
+                map[i] = right;
+                continue;
+            }
+        }
+        int j;
+        for (j = 0; j < n; j++) {
+            if (out[j].kind == op.kind && ((out[j].left == left && out[j].right == right) ||
+                                           (commutes && out[j].left == right && out[j].right == left))) break;
+        }
+        if (j == n) {
+            out[n] = op;
+            out[n].left = left;
+            out[n].right = right;
+            n++;
+        }
+        map[i] = j;
+    }
+    // Dead op elimination: keep guards, whatever the result, branches and loop
+    // depend on, and ops that may overflow for some argument, which the
+    // interpreter would raise even if the value goes unused
+    unsigned char check[TRACE_MAX_OPS];
+    trace_ranges(out, n, (long long)INT_MAX + 1, check);
+    int live[TRACE_MAX_OPS] = { 0 };
+    if (result >= 0) live[map[result]] = 1;
+    for (int i = n - 1; i >= 0; i--) {
+        if (out[i].kind == TRACE_GUARD || trace_is_branch(out[i].kind) || out[i].kind == TRACE_LOOP || check[i]) {
+            live[i] = 1;
+        }
+        if (live[i] && trace_reads_operands(out[i].kind)) live[out[i].left] = live[out[i].right] = 1;
+    }
+    int renumber[TRACE_MAX_OPS];
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+        if (!live[i]) continue;
+        out[kept] = out[i];
+        if (trace_reads_operands(out[kept].kind)) {
+            out[kept].left = renumber[out[kept].left];
+            out[kept].right = renumber[out[kept].right];
+        }
+        renumber[i] = kept++;
+    }
+    *out_result = result >= 0 ? renumber[map[result]] : -1;
+    return kept;
+}
+
+#if defined(__x86_64__)
+#define OPT_SCRATCH R11  // Holds results bound for a frame slot
+#define OPT_FLOAT_SCRATCH 15  // xmm15, the same for floats
+static const int opt_registers[] = { RAX, RCX, RDX, R8, R9, R10 };
+#define OPT_REGISTER_COUNT (int)(sizeof(opt_registers) / sizeof(opt_registers[0]))
+static const int opt_float_registers[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13 };  // xmm0 to xmm13
+#define OPT_FLOAT_REGISTER_COUNT (int)(sizeof(opt_float_registers) / sizeof(opt_float_registers[0]))
+
+typedef enum { LOC_NONE, LOC_REG, LOC_SLOT, LOC_IMM } LocKind;
+
+typedef struct {
+    LocKind kind;
+    int n;  // Register, frame slot or immediate
+} Loc;
+
+// 32-bit "opcode reg, src" with src a register or frame slot
+void emit_op_loc(CodeBuffer *code, const unsigned char *opcode, size_t length, int reg, Loc src) {
+    emit_rex(code, reg, src.kind == LOC_REG ? src.n : 0);
+    emit(code, opcode, length);
+    if (src.kind == LOC_REG) {
+        emit_byte(code, 0xc0 | (reg & 7) << 3 | (src.n & 7));
+    } else {
+        emit_byte(code, 0x85 | (reg & 7) << 3);
+        emit_u32(code, (uint32_t)(-8 * (src.n + 1)));
+    }
+}
+
+void emit_load(CodeBuffer *code, int reg, Loc src) {
+    if (src.kind == LOC_REG && src.n == reg) return;
+    if (src.kind == LOC_IMM) {
+        emit_rex(code, 0, reg);
+        emit_byte(code, 0xb8 + (reg & 7));  // mov r32, imm32
+        emit_u32(code, (uint32_t)src.n);
+    } else {
+        emit_op_loc(code, (unsigned char[]){ 0x8b }, 1, reg, src);  // mov r32, r/m32
+    }
+}
+
+// SSE "prefix 0f opcode xmm, src"; the prefix goes ahead of any REX byte
+void emit_sse_loc(CodeBuffer *code, unsigned char prefix, unsigned char opcode, int xmm, Loc src) {
+    emit_byte(code, prefix);
+    emit_op_loc(code, (unsigned char[]){ 0x0f, opcode }, 2, xmm, src);
+}
+
+void emit_float_load(CodeBuffer *code, int xmm, Loc src) {
+    if (src.kind == LOC_REG && src.n == xmm) return;
+    if (src.kind == LOC_REG) {
+        emit_sse_loc(code, 0x66, 0x28, xmm, src);  // movapd xmm, xmm
+    } else {
+        emit_sse_loc(code, 0xf2, 0x10, xmm, src);  // movsd xmm, m64
+    }
+}
+
+void emit_float_store(CodeBuffer *code, int xmm, Loc slot) {
+    emit_sse_loc(code, 0xf2, 0x11, xmm, slot);  // movsd m64, xmm
+}
+
+void emit_float_const(CodeBuffer *code, int xmm, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    emit(code, (unsigned char[]){ 0x49, 0xbb }, 2);  // mov r11, imm64
+    emit_u64(code, bits);
+    emit(code, (unsigned char[]){ 0x66, 0x49 | (xmm >= 8 ? 4 : 0), 0x0f, 0x6e, 0xc3 | (xmm & 7) << 3 }, 5);  // movq xmm, r11
+}
+
+// Ops given a register or frame slot; int constants are immediates instead
+int opt_needs_location(TraceOp *op) {
+    if (op->kind == TRACE_ARG) return 1;
+    if (op->kind == TRACE_CONST) return op->flonum;
+    return trace_reads_operands(op->kind) && !trace_is_branch(op->kind) && op->kind != TRACE_LOOP;
+}
+
+TraceCode opt_compile(TraceOp *ops, int count, int result, size_t *size) {
+    Loc loc[TRACE_MAX_OPS];
+    int end[TRACE_MAX_OPS];
+    for (int i = 0; i < count; i++) {
+        loc[i].kind = LOC_NONE;
+        end[i] = i;
+        if (trace_reads_operands(ops[i].kind)) end[ops[i].left] = end[ops[i].right] = i;
+        if (ops[i].kind == TRACE_CONST && !ops[i].flonum) loc[i] = (Loc){ LOC_IMM, ops[i].value };
+    }
+    if (result >= 0) end[result] = count;
+    // Linear scan: intervals start in op order; active holds the ones with
+    // registers. Ints and floats are scanned as two classes, indexed by flonum,
+    // each with its own registers but sharing the frame slots
+    int active[2][OPT_FLOAT_REGISTER_COUNT], active_count[2] = { 0, 0 }, slots = 0;
+    int free_registers[2][OPT_FLOAT_REGISTER_COUNT], free_count[2] = { OPT_REGISTER_COUNT, OPT_FLOAT_REGISTER_COUNT };
+    memcpy(free_registers[0], opt_registers, sizeof(opt_registers));
+    memcpy(free_registers[1], opt_float_registers, sizeof(opt_float_registers));
+    for (int i = 0; i < count; i++) {
+        if (!opt_needs_location(&ops[i])) continue;
+        int c = ops[i].flonum;
+        for (int a = 0; a < active_count[c]; a++) {
+            if (end[active[c][a]] > i) continue;
+            free_registers[c][free_count[c]++] = loc[active[c][a]].n;
+            active[c][a--] = active[c][--active_count[c]];
+        }
+        if (free_count[c] > 0) {
+            loc[i] = (Loc){ LOC_REG, free_registers[c][--free_count[c]] };
+            active[c][active_count[c]++] = i;
+            continue;
+        }
+        int spill = 0;
+        for (int a = 1; a < active_count[c]; a++) {
+            if (end[active[c][a]] > end[active[c][spill]]) spill = a;
+        }
+        if (end[active[c][spill]] > end[i]) {
+            loc[i] = loc[active[c][spill]];
+            loc[active[c][spill]] = (Loc){ LOC_SLOT, slots++ };
+            active[c][spill] = i;
+        } else {
+            loc[i] = (Loc){ LOC_SLOT, slots++ };
+        }
+    }
+    // A spilled interval lives in its slot from definition to last use
+    CodeBuffer code = { .length = 0 };
+    size_t exits[2 * TRACE_MAX_OPS];
+    int exit_count = 0;
+    unsigned char check[TRACE_MAX_OPS];
+    long long bound = trace_bound(ops, count, check);
+    if (slots > 0) {
+        emit(&code, (unsigned char[]){ 0x55, 0x48, 0x89, 0xe5, 0x48, 0x81, 0xec }, 7);  // push rbp; mov rbp, rsp; sub rsp, imm32
+        emit_u32(&code, (uint32_t)((8 * slots + 15) & ~15));
+    }
+    size_t head = code.length;
+    for (int i = 0; i < count; i++) {
+        TraceOp *op = &ops[i];
+        if (op->flonum && op->kind != TRACE_LOOP && !trace_is_branch(op->kind)) {
+            int target = loc[i].kind == LOC_REG ? loc[i].n : OPT_FLOAT_SCRATCH;
+            if (op->kind == TRACE_ARG) {
+                emit_float_arg(&code, 0x10, target, op->left);  // movsd xmm, [argument]
+            } else if (op->kind == TRACE_CONST) {
+                emit_float_const(&code, target, op->float_value);
+            } else if (op->kind == TRACE_FLOAT) {
+                Loc value = loc[op->left];
+                if (value.kind == LOC_IMM) {
+                    emit_load(&code, OPT_SCRATCH, value);
+                    value = (Loc){ LOC_REG, OPT_SCRATCH };
+                }
+                emit_sse_loc(&code, 0xf2, 0x2a, target, value);  // cvtsi2sd xmm, r/m32
+            } else {
+                Loc left = loc[op->left], right = loc[op->right];
+                int dest = target;
+                if (right.kind == LOC_REG && right.n == target && !(left.kind == LOC_REG && left.n == target)) {
+                    if (op->kind == TRACE_SUB) {
+                        dest = OPT_FLOAT_SCRATCH;
+                    } else {
+                        Loc swap = left;
+                        left = right;
+                        right = swap;
+                    }
+                }
+                emit_float_load(&code, dest, left);
+                emit_sse_loc(&code, 0xf2, float_arith_opcode(op->kind), dest, right);  // addsd/subsd/mulsd xmm, r/m64
+                if (dest != target) emit_float_load(&code, target, (Loc){ LOC_REG, dest });
+            }
+            if (loc[i].kind == LOC_SLOT) emit_float_store(&code, target, loc[i]);
+            continue;
+        }
+        if (op->kind == TRACE_ARG) {
+            int target = loc[i].kind == LOC_REG ? loc[i].n : OPT_SCRATCH;
+            emit_arg(&code, 0x8b, target, op->left);  // mov r32, [argument]
+            emit_arg_guard(&code, target, bound, exits, &exit_count);
+            if (loc[i].kind == LOC_SLOT) emit_op_loc(&code, (unsigned char[]){ 0x89 }, 1, target, loc[i]);  // mov r/m32, r32
+            continue;
+        }
+        if (op->kind == TRACE_LOOP && op->flonum) {
+            Loc value = loc[op->left];
+            int reg = value.kind == LOC_REG ? value.n : OPT_FLOAT_SCRATCH;
+            emit_float_load(&code, reg, value);
+            emit_float_arg(&code, 0x11, reg, op->value);  // movsd [argument], xmm
+            continue;
+        }
+        if (op->kind == TRACE_LOOP) {
+            Loc value = loc[op->left];
+            if (value.kind == LOC_IMM) {
+                emit(&code, (unsigned char[]){ 0xc7, 0x87 }, 2);  // mov dword [argument], imm32
+                emit_u32(&code, (uint32_t)(8 * op->value));
+                emit_u32(&code, (uint32_t)value.n);
+                continue;
+            }
+            int reg = value.kind == LOC_REG ? value.n : OPT_SCRATCH;
+            emit_load(&code, reg, value);
+            emit_arg(&code, 0x89, reg, op->value);  // mov [argument], r32
+            continue;
+        }
+        if (op->kind == TRACE_GUARD) {
+            emit(&code, (unsigned char[]){ 0x48, 0xb8 }, 2);  // mov rax, cell
+            emit_u64(&code, (uint64_t)(uintptr_t)op->cell);
+            emit(&code, (unsigned char[]){ 0x48, 0x8b, 0x00, 0x48, 0xb9 }, 5);  // mov rax, [rax]; mov rcx, expected
+            emit_u64(&code, (uint64_t)(uintptr_t)op->expected);
+            emit(&code, (unsigned char[]){ 0x48, 0x39, 0xc8 }, 3);  // cmp rax, rcx
+            emit_exit_jump(&code, (unsigned char[]){ 0x0f, 0x85 }, exits, &exit_count);  // jne exit
+            continue;
+        }
+        if (trace_is_branch(op->kind) && op->flonum) {
+            int swaps = float_branch_swaps(op);
+            Loc first = loc[swaps ? op->right : op->left], second = loc[swaps ? op->left : op->right];
+            int reg = first.kind == LOC_REG ? first.n : OPT_FLOAT_SCRATCH;
+            emit_float_load(&code, reg, first);
+            emit_sse_loc(&code, 0x66, 0x2e, reg, second);  // ucomisd xmm, r/m64
+            emit_float_branch_exit(&code, op, exits, &exit_count);
+            continue;
+        }
+        if (trace_is_branch(op->kind)) {
+            Loc left = loc[op->left], right = loc[op->right];
+            int reg = left.kind == LOC_REG ? left.n : OPT_SCRATCH;
+            emit_load(&code, reg, left);
+            if (right.kind == LOC_IMM) {
+                emit_rex(&code, 0, reg);
+                emit(&code, (unsigned char[]){ 0x81, 0xf8 | (reg & 7) }, 2);  // cmp r32, imm32
+                emit_u32(&code, (uint32_t)right.n);
+            } else {
+                emit_op_loc(&code, (unsigned char[]){ 0x3b }, 1, reg, right);  // cmp r32, r/m32
+            }
+            emit_exit_jump(&code, (unsigned char[]){ 0x0f, branch_exit_condition(op) }, exits, &exit_count);
+            continue;
+        }
+        if (!trace_reads_operands(op->kind)) continue;
+        Loc left = loc[op->left], right = loc[op->right];
+        int target = loc[i].kind == LOC_REG ? loc[i].n : OPT_SCRATCH;
+        int dest = target;  // Where the two-address form computes, moved to target after
+        if (right.kind == LOC_REG && right.n == target && !(left.kind == LOC_REG && left.n == target)) {
+            if (op->kind == TRACE_SUB) {
+                dest = OPT_SCRATCH;  // Does not commute: compute aside rather than clobber right
+            } else {
+                Loc swap = left;  // Keep the two-address form from clobbering right
+                left = right;
+                right = swap;
+            }
+        }
+        if (left.kind == LOC_IMM && op->kind != TRACE_SUB) {
+            Loc swap = left;
+            left = right;
+            right = swap;
+        }
+        emit_load(&code, dest, left);
+        if (right.kind == LOC_IMM) {
+            if (op->kind == TRACE_MUL) {
+                emit_rex(&code, dest, dest);
+                emit(&code, (unsigned char[]){ 0x69, 0xc0 | (dest & 7) << 3 | (dest & 7) }, 2);  // imul r32, r32, imm32
+            } else {
+                emit_rex(&code, 0, dest);
+                emit(&code, (unsigned char[]){ 0x81, (op->kind == TRACE_ADD ? 0xc0 : 0xe8) | (dest & 7) }, 2);  // add/sub r32, imm32
+            }
+            emit_u32(&code, (uint32_t)right.n);
+        } else if (op->kind == TRACE_ADD) {
+            emit_op_loc(&code, (unsigned char[]){ 0x03 }, 1, dest, right);  // add r32, r/m32
+        } else if (op->kind == TRACE_SUB) {
+            emit_op_loc(&code, (unsigned char[]){ 0x2b }, 1, dest, right);  // sub r32, r/m32
+        } else {
+            emit_op_loc(&code, (unsigned char[]){ 0x0f, 0xaf }, 2, dest, right);  // imul r32, r/m32
+        }
+        if (check[i]) emit_exit_jump(&code, (unsigned char[]){ 0x0f, 0x80 }, exits, &exit_count);  // jo exit
+        if (dest != target) emit_load(&code, target, (Loc){ LOC_REG, dest });
+        if (loc[i].kind == LOC_SLOT) {
+            emit_op_loc(&code, (unsigned char[]){ 0x89 }, 1, target, loc[i]);  // mov r/m32, r32
+        }
+    }
+    if (result < 0) {
+        emit_loop_jump(&code, head);
+    } else {
+        Loc value = loc[result];
+        if (ops[result].flonum) {
+            int reg = value.kind == LOC_REG ? value.n : OPT_FLOAT_SCRATCH;
+            emit_float_load(&code, reg, value);
+            emit_byte(&code, 0xf2);
+            emit_rex(&code, reg, 0);
+            emit(&code, (unsigned char[]){ 0x0f, 0x11, 0x06 | (reg & 7) << 3 }, 3);  // movsd [rsi], xmm
+        } else if (value.kind == LOC_IMM) {
+            emit(&code, (unsigned char[]){ 0xc7, 0x06 }, 2);  // mov dword [rsi], imm32
+            emit_u32(&code, (uint32_t)value.n);
+        } else {
+            if (value.kind == LOC_SLOT) {
+                emit_load(&code, OPT_SCRATCH, value);
+                value = (Loc){ LOC_REG, OPT_SCRATCH };
+            }
+            emit_rex(&code, value.n, 0);
+            emit(&code, (unsigned char[]){ 0x89, 0x06 | (value.n & 7) << 3 }, 2);  // mov [rsi], r32
+        }
+        emit(&code, (unsigned char[]){ 0x31, 0xc0 }, 2);  // xor eax, eax
+        if (slots > 0) emit_byte(&code, 0xc9);  // leave
+        emit_byte(&code, 0xc3);
+    }
+    size_t side_exit = code.length;
+    emit(&code, (unsigned char[]){ 0xb8, 0x01, 0x00, 0x00, 0x00 }, 5);  // mov eax, 1
+    if (slots > 0) emit_byte(&code, 0xc9);
+    emit_byte(&code, 0xc3);
+    for (int i = 0; i < exit_count; i++) {
+        uint32_t rel = (uint32_t)(side_exit - (exits[i] + 4));
+        memcpy(code.bytes + exits[i], &rel, 4);
+    }
+    return code_install(&code, size);
+}
+#else
+TraceCode opt_compile(TraceOp *ops, int count, int result, size_t *size) {
+    (void)ops, (void)count, (void)result, (void)size;
+    return NULL;
+}
+#endif
+
+// Replace a hot trace's template code with optimized code
+void trace_optimize(Trace *trace) {
+    TraceOp ops[TRACE_MAX_OPS];
+    int result;
+    int count = opt_simplify(trace->ops, trace->op_count, trace->result, ops, &result);
+    size_t size;
+    TraceCode code = opt_compile(ops, count, result, &size);
+    if (code == NULL) return;
+    munmap((void *)trace->code, trace->code_size);
+    trace->code = code;
+    trace->code_size = size;
+    trace->optimized = 1;
+    jit_optimized++;
+}
+
+void trace_discard(Trace *trace) {
+    if (trace->code != NULL) munmap((void *)trace->code, trace->code_size);
+    free(trace->ops);
+    free(trace->callees);
+    trace->code = NULL;
+    trace->ops = NULL;
+    trace->op_count = 0;
+    trace->callees = NULL;
+    trace->callee_count = 0;
+}
+
+// Back off exponentially, then leave the lambda to the interpreter
+void trace_abort(Trace *trace) {
+    trace->countdown = ++trace->aborts < TRACE_MAX_ABORTS ? JIT_HOT_CALLS << trace->aborts : -1;
+}
+
+// The anchored lambda's arguments, outermost first, from the innermost
+// bindings of env, with a bit set in *flonums for each that is a float; 0
+// unless they are all numbers
+int trace_args(Trace *trace, Environment *env, uint64_t *args, int *flonums) {
+    *flonums = 0;
+    for (int position = trace->arity - 1; position >= 0; position--, env = env->next) {
+        Expr *value = env->value;
+        if (value->type == INT_LITERAL) {
+            args[position] = (uint32_t)value->data.int_value;
+        } else if (value->type == FLOAT_LITERAL) {
+            memcpy(&args[position], &value->data.float_value, sizeof(uint64_t));
+            *flonums |= 1 << position;
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// The number a word passed to or from a trace holds
+Number trace_number(uint64_t word, int flonum) {
+    double value;
+    if (!flonum) return number_int((int32_t)word);
+    memcpy(&value, &word, sizeof(value));
+    return number_double(value);
+}
+
+// env with the anchored lambda's parameters bound to args instead
+Environment *trace_rebind(Trace *trace, Environment *env, uint64_t *args) {
+    char *params[TRACE_MAX_ARGS];
+    for (int position = trace->arity - 1; position >= 0; position--, env = env->next) params[position] = env->var;
+    for (int position = 0; position < trace->arity; position++) {
+        Number value = trace_number(args[position], trace->flonums >> position & 1);
+        env = env_create(params[position], number_box(value), env);
+    }
+    return env;
+}
+
+// Bind the anchored lambda's parameters, in env, to argument ops; returns
+// the bindings, innermost first as env has them
+TraceBinding *trace_params(TraceRecorder *rec, Trace *trace, Environment *env, uint64_t *args) {
+    Environment *bound[TRACE_MAX_ARGS];
+    rec->base = env;
+    for (int position = trace->arity - 1; position >= 0; position--, rec->base = rec->base->next) {
+        bound[position] = rec->base;
+    }
+    TraceBinding *params = NULL;
+    for (int position = 0; position < trace->arity; position++) {
+        Number value = trace_number(args[position], trace->flonums >> position & 1);
+        TraceOp entry = { TRACE_ARG, position, 0, 0, NULL, NULL, !number_is_int(value), 0 };
+        if (entry.flonum) entry.float_value = number_to_double(value);
+        else entry.value = (int32_t)value;
+        TraceBinding *param = &rec->bindings[rec->binding_count++];
+        param->var = bound[position]->var;
+        param->value = trace_op(rec, entry, value);
+        param->next = params;
+        params = param;
+    }
+    return params;
+}
+
+// Record the call that just got hot; returns its result, or NULL if the
+// interpreter should run the call instead: the trace aborted, or it closes a
+// loop, which the call's tail call will enter
+Expr *trace_start(Expr *anchor, Environment *env) {
+    Trace *trace = anchor->data.trace;
+    uint64_t args[TRACE_MAX_ARGS];
+    if (!trace_args(trace, env, args, &trace->flonums)) {
+        trace->countdown = JIT_HOT_CALLS;
+        return NULL;
+    }
+    TraceRecorder *rec = malloc(sizeof(TraceRecorder));
+    rec->count = 0;
+    rec->binding_count = 0;
+    rec->depth = 0;
+    rec->anchor = anchor;
+    rec->tail = trace->body;
+    rec->looped = 0;
+    rec->callee_count = 0;
+    TraceBinding *params = trace_params(rec, trace, env, args);
+    if (setjmp(rec->abort) != 0) {
+        free(rec);
+        trace_abort(trace);
+        return NULL;
+    }
+    TraceValue value = trace_record(rec, trace->body, params, rec->base);
+    int looped = rec->looped;
+    int result = looped ? -1 : value.op;
+    if ((result < 0 && !looped) || (trace->code = trace_compile(rec->ops, rec->count, result, &trace->code_size)) == NULL) {
+        free(rec);
+        trace_abort(trace);
+        return NULL;
+    }
+    trace->ops = malloc(rec->count * sizeof(TraceOp));
+    memcpy(trace->ops, rec->ops, rec->count * sizeof(TraceOp));
+    trace->op_count = rec->count;
+    trace->callees = malloc(rec->callee_count * sizeof(Expr *));
+    memcpy(trace->callees, rec->callees, rec->callee_count * sizeof(Expr *));
+    trace->callee_count = rec->callee_count;
+    trace->result = result;
+    trace->side_exits = 0;
+    trace->runs = 0;
+    trace->optimized = 0;
+    jit_traces++;
+    if (looped) jit_loops++;
+    free(rec);
+    return looped ? NULL : number_box(value.value);
+}
+
+// A guard failed: count it, and give up on a trace that keeps failing
+void trace_side_exit(Trace *trace) {
+    jit_side_exits++;
+    if (++trace->side_exits == TRACE_MAX_SIDE_EXITS) {  // A guarded global changed for good, or the path did
+        // Exiting more often than not: calls spread over branches one trace cannot cover
+        int unstable = trace->runs < TRACE_MAX_SIDE_EXITS;
+        trace_discard(trace);
+        if (unstable) trace_abort(trace);
+        else trace->countdown = JIT_HOT_CALLS;
+    }
+}
+
+// Run the anchored call on its trace if it has one. Returns the result, or
+// NULL for the interpreter to run the body in *env, which a loop that ran
+// some iterations has rebound to the arguments of the iteration it left.
+Expr *trace_enter(Expr *anchor, Environment **env) {
+    Trace *trace = anchor->data.trace;
+    if (trace->code != NULL) {
+        uint64_t args[TRACE_MAX_ARGS];
+        int flonums;
+        if (!trace_args(trace, *env, args, &flonums)) return NULL;
+        if (flonums != trace->flonums) {  // The entry type guard: the code is specialized to each argument's type
+            trace_side_exit(trace);
+            return NULL;
+        }
+        int iterations = safepoint_countdown < SAFEPOINT_INTERVAL ? (int)safepoint_countdown : SAFEPOINT_INTERVAL;
+        uint64_t result = (uint32_t)iterations;
+        if (trace->code(args, &result) == 0) {
+            if (!trace->optimized && ++trace->runs == OPT_HOT_CALLS) trace_optimize(trace);
+            return number_box(trace_number(result, trace->ops[trace->result].flonum));
+        }
+        int left = (int)result;  // Iterations a loop had left when it exited
+        if (trace->result < 0 && left < iterations) {
+            // Left the loop after some iterations, through a guard or for a safepoint; each was a call
+            *env = trace_rebind(trace, *env, args);
+            if (!trace->optimized && ++trace->runs == OPT_HOT_CALLS) trace_optimize(trace);
+            if ((safepoint_countdown -= iterations - left) <= 0) budget_check();
+            return NULL;
+        }
+        trace_side_exit(trace);
+        return NULL;
+    }
+    if (trace->countdown > 0 && --trace->countdown == 0) return trace_start(anchor, *env);
+    return NULL;
+}
+
+// Superinstructions. The dispatch pairs and triples in the PROFILE_EVAL
+// report are led by + and * of two variables or of a variable and a
+// constant, and by calls of a global on a variable. Compiled bodies get a
+// fused node for each, which eval runs without dispatching on its operands.
+// An if on < or = becomes a compare-and-branch, which decides on the unboxed
+// operands instead of making a boolean and testing it. Fused nodes are new,
+// since compiled bodies share unchanged nodes with their source.
+Expr *fuse(Expr *expr) {
+    switch (expr->type) {
+        case LAMBDA: {
+            Expr *body = fuse(expr->data.lambda.body);
+            return body == expr->data.lambda.body ? expr : make_lambda(expr->data.lambda.param, body);
+        }
+        case APPLY: {
+            Expr *func = fuse(expr->data.apply.func);
+            Expr *arg = fuse(expr->data.apply.arg);
+            if (func->type == GLOBAL_REF && arg->type == VAR) {
+                Expr *fused = make_apply(func, arg);
+                fused->type = APPLY_GLOBAL_VAR;
+                return fused;
+            }
+            if (func == expr->data.apply.func && arg == expr->data.apply.arg) return expr;
+            return make_apply(func, arg);
+        }
+        case LIFTED_CALL: {  // Made by this compile, so it can be updated in place
+            Lifted *lifted = expr->data.lifted;
+            for (int i = 0; i < lifted->count; i++) lifted->args[i] = fuse(lifted->args[i]);
+            lifted->body = fuse(lifted->body);
+            return expr;
+        }
+        case IF:
+        case BRANCHES: {
+            Expr *left = fuse(expr->data.binop.left);
+            Expr *right = fuse(expr->data.binop.right);
+            if (expr->type == IF && (left->type == LESS || left->type == NUM_EQUAL)) {
+                Expr *fused = make_binop(IF, left, right);
+                fused->type = left->type == LESS ? IF_LESS : IF_NUM_EQUAL;
+                fused->site = expr->site;
+                return fused;
+            }
+            if (left == expr->data.binop.left && right == expr->data.binop.right) return expr;
+            Expr *result = make_binop(expr->type, left, right);
+            result->site = expr->site;
+            return result;
+        }
+        case QUOTE:
+        case DEFINE:
+            return expr;
+        default: {
+            const SpecialForm *form = special_form_of(expr->type);
+            if (form == NULL) return expr;
+            if (form->arity == 1) {
+                Expr *arg = fuse(expr->data.apply.arg);
+                return arg == expr->data.apply.arg ? expr : make_unary(expr->type, arg);
+            }
+            Expr *left = fuse(expr->data.binop.left);
+            Expr *right = fuse(expr->data.binop.right);
+            if ((expr->type == ADD || expr->type == MULTIPLY) && left->type == VAR &&
+                (right->type == VAR || right->type == INT_LITERAL)) {
+                Expr *fused = make_binop(expr->type, left, right);
+                if (right->type == VAR) fused->type = expr->type == ADD ? ADD_VAR_VAR : MUL_VAR_VAR;
+                else fused->type = expr->type == ADD ? ADD_VAR_INT : MUL_VAR_INT;
+                return fused;
+            }
+            if (left == expr->data.binop.left && right == expr->data.binop.right) return expr;
+            return make_binop(expr->type, left, right);
+        }
+    }
+}
+
+// Anchor the innermost body of a chain of lambdas, the one a curried call
+// runs once it has all arity arguments
+Expr *trace_anchor_curried(Expr *body, int hot, int arity) {
+    if (body->type != LAMBDA) return arity <= TRACE_MAX_ARGS ? make_trace_anchor(body, hot, arity) : body;
+    Expr *inner = trace_anchor_curried(body->data.lambda.body, hot, arity + 1);
+    return inner == body->data.lambda.body ? body : make_lambda(body->data.lambda.param, inner);
+}
+
+// The trace anchored in unit's compiled body, if any
+Trace *unit_trace(CompiledLambda *unit) {
+    Expr *body = unit->lambda->data.lambda.body;
+    while (body->type == LAMBDA) body = body->data.lambda.body;
+    return body->type == TRACE_ANCHOR ? body->data.trace : NULL;
+}
+
+// A hot lambda whose profile saw its arithmetic on one operand type is
+// recorded on its first call; one that mixed types waits to get hot again,
+// since its first call may not show the types that stay
+void compile_lambda(CompiledLambda *unit) {
+    HashScope param = { unit->lambda->data.lambda.param, NULL };
+    unit->dep_count = 0;
+    unit->branch_count = 0;
+    unit->cold = 0;
+    Trace *old = unit_trace(unit);
+    if (old != NULL) trace_discard(old);
+    Expr *body = fuse(compile_expr(unit, unit->source, &param, 0));
+    PgoCounts *prior = unit->prior != NULL ? &unit->prior->counts : NULL;
+    if (jit_enabled && !lazy_mode) {
+        int monomorphic = prior != NULL && (prior->other_ops == 0 || prior->int_ops == 0);
+        body = trace_anchor_curried(body, monomorphic && prior->calls >= PGO_HOT_CALLS, 1);
+    }
+    unit->lambda->data.lambda.body = body;
+}
+
+void compile_definition(char *name, Expr *lambda) {
+    CompiledLambda *unit;
+    for (unit = compiled_lambdas; unit != NULL; unit = unit->next) {
+        if (strcmp(unit->name, name) == 0) break;
+    }
+    if (unit == NULL) {
+        unit = calloc(1, sizeof(CompiledLambda));
+        unit->name = name;
+        unit->next = compiled_lambdas;
+        compiled_lambdas = unit;
+    }
+    Expr *source = lambda->data.lambda.body;
+    for (CompiledLambda *c = compiled_lambdas; c != NULL; c = c->next) {
+        if (c->lambda == lambda) source = c->source;  // Defined again: its body is compiled code by now
+    }
+    unit->lambda = lambda;
+    unit->source = source;
+    unit->hash = definition_hash(make_lambda(lambda->data.lambda.param, source), NULL, NULL, NULL);
+    memset(&unit->counts, 0, sizeof(unit->counts));
+    unit->prior = NULL;
+    for (PgoRecord *record = pgo_records; record != NULL; record = record->next) {
+        if (record->hash == unit->hash && strcmp(record->name, name) == 0) {
+            record->matched = 1;
+            unit->prior = record;
+        }
+    }
+    compile_lambda(unit);
+}
+
+// Counters for a call of lambda: its own if it is a top-level definition,
+// those of the definition that made it if it is an inner lambda, otherwise
+// the caller's keep counting
+PgoCounts *pgo_enter(PgoCounts *caller, Expr *lambda) {
+    CompiledLambda *unit;
+    for (unit = compiled_lambdas; unit != NULL; unit = unit->next) {
+        if (unit->lambda == lambda) break;
+    }
+    if (unit == NULL) return lambda->site != 0 ? pgo_sites[lambda->site].counts : caller;
+    unit->counts.calls++;
+    if (caller != NULL) {
+        int i;
+        for (i = 0; i < caller->target_count && caller->targets[i].name != unit->name; i++) { }
+        if (i < caller->target_count) {
+            caller->targets[i].count++;
+        } else if (i < PGO_MAX_TARGETS) {
+            caller->targets[i].name = unit->name;
+            caller->targets[i].count = 1;
+            caller->target_count++;
+        }
+    }
+    return &unit->counts;
+}
+
+void pgo_merge(PgoCounts *into, PgoCounts *from) {
+    into->calls += from->calls;
+    into->int_ops += from->int_ops;
+    into->other_ops += from->other_ops;
+    for (int i = 0; i < PGO_MAX_BRANCHES; i++) {
+        into->branches[i][0] += from->branches[i][0];
+        into->branches[i][1] += from->branches[i][1];
+    }
+    for (int j = 0; j < from->target_count; j++) {
+        int i;
+        for (i = 0; i < into->target_count && strcmp(into->targets[i].name, from->targets[j].name) != 0; i++) { }
+        if (i == into->target_count) {
+            if (i == PGO_MAX_TARGETS) continue;
+            into->targets[i].name = from->targets[j].name;
+            into->targets[i].count = 0;
+            into->target_count++;
+        }
+        into->targets[i].count += from->targets[j].count;
+    }
+}
+
+// One line per lambda: hash name calls int-ops other-ops [callee=count ...] [#if=then:else ...]
+void pgo_load(const char *path) {
+    FILE *in = fopen(path, "r");
+    if (!in) return;  // First run
+    char line[1024];
+    while (fgets(line, sizeof(line), in)) {
+        char name[256];
+        unsigned long long hash;
+        PgoCounts counts = { 0 };
+        int used;
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%llx %255s %llu %llu %llu%n", &hash, name, &counts.calls, &counts.int_ops,
+                   &counts.other_ops, &used) != 5) continue;
+        char *p = line + used;
+        char token[256], target[256];
+        for (; sscanf(p, " %255s%n", token, &used) == 1; p += used) {
+            int branch;
+            unsigned long long count, then, otherwise;
+            if (sscanf(token, "#%d=%llu:%llu", &branch, &then, &otherwise) == 3) {
+                if (branch < 0 || branch >= PGO_MAX_BRANCHES) continue;
+                counts.branches[branch][0] = then;
+                counts.branches[branch][1] = otherwise;
+            } else if (counts.target_count < PGO_MAX_TARGETS && sscanf(token, "%255[^=]=%llu", target, &count) == 2) {
+                counts.targets[counts.target_count].name = strdup(target);
+                counts.targets[counts.target_count++].count = count;
+            }
+        }
+        PgoRecord *record = calloc(1, sizeof(PgoRecord));
+        record->name = strdup(name);
+        record->hash = hash;
+        record->counts = counts;
+        record->next = pgo_records;
+        pgo_records = record;
+    }
+    fclose(in);
+}
+
+void pgo_write_counts(FILE *out, const char *name, uint64_t hash, PgoCounts *counts) {
+    fprintf(out, "%016llx %s %llu %llu %llu", (unsigned long long)hash, name, counts->calls, counts->int_ops,
+            counts->other_ops);
+    for (int i = 0; i < counts->target_count; i++) fprintf(out, " %s=%llu", counts->targets[i].name, counts->targets[i].count);
+    for (int i = 0; i < PGO_MAX_BRANCHES; i++) {
+        if (counts->branches[i][0] || counts->branches[i][1]) {
+            fprintf(out, " #%d=%llu:%llu", i, counts->branches[i][0], counts->branches[i][1]);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+// atexit: this run's counts merged with the saved ones, plus saved records
+// for definitions this run did not make
+void pgo_save(void) {
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", pgo_path);
+    FILE *out = fopen(tmp_path, "w");
+    if (!out) {
+        fprintf(stderr, "Cannot write profile: %s\n", tmp_path);
+        return;
+    }
+    fprintf(out, "# scheme profile: hash name calls int-ops other-ops callee=calls... #if=then:else...\n");
+    for (CompiledLambda *unit = compiled_lambdas; unit != NULL; unit = unit->next) {
+        PgoCounts counts = unit->counts;
+        if (unit->prior != NULL) pgo_merge(&counts, &unit->prior->counts);
+        pgo_write_counts(out, unit->name, unit->hash, &counts);
+    }
+    for (PgoRecord *record = pgo_records; record != NULL; record = record->next) {
+        if (!record->matched) pgo_write_counts(out, record->name, record->hash, &record->counts);
+    }
+    fclose(out);
+    rename(tmp_path, pgo_path);
+}
+
+// Discard the traces that recorded through lambda's old body. The global
+// guards cannot catch this: the closure stays the same.
+void invalidate_traces(Expr *lambda) {
+    for (CompiledLambda *unit = compiled_lambdas; unit != NULL; unit = unit->next) {
+        Trace *trace = unit_trace(unit);
+        if (trace == NULL) continue;
+        for (int i = 0; i < trace->callee_count; i++) {
+            if (trace->callees[i] != lambda) continue;
+            trace_discard(trace);
+            trace->countdown = JIT_HOT_CALLS;
+            break;
+        }
+    }
+}
+
+// name was (re)defined: recompile every lambda that baked in its old value,
+// and rehash the stored memoized procedures that read it
+void invalidate_dependents(char *name) {
+    memo_redefined(name);
+    for (CompiledLambda *unit = compiled_lambdas; unit != NULL; unit = unit->next) {
+        if (strcmp(unit->name, name) == 0) continue;
+        for (int i = 0; i < unit->dep_count; i++) {
+            if (strcmp(unit->deps[i], name) != 0) continue;
+            compile_lambda(unit);
+            invalidate_traces(unit->lambda);
+            recompilations++;
+            break;
+        }
+    }
+}
+
+Expr *eval_var(char *var, Environment *env) {
+    Expr *value = env_resolve(env, var);
+    if (value == NULL) {
+        scheme_error("unbound-variable", "Unbound variable: %s", var);
+    }
+    return force(value);
+}
+
+void pgo_count_op(Number left, Number right) {
+    if (number_is_int(left) && number_is_int(right)) pgo_current->int_ops++;
+    else pgo_current->other_ops++;
+}
+
+// +, - or * of evaluated operands
+Number arith(ExprType type, Number left, Number right) {
+    if (pgo_current != NULL) pgo_count_op(left, right);
+    Number value;
+    if (!number_arith(type, left, right, &value)) {
+        const char *name = type == ADD ? "addition" : type == SUBTRACT ? "subtraction" : "multiplication";
+        if (left == NUMBER_NONE || right == NUMBER_NONE) {
+            scheme_error("type-error", type == ADD ? "Addition requires numbers"
+                                       : type == SUBTRACT ? "Subtraction requires numbers" : "Multiplication requires numbers");
+        }
+        scheme_error("overflow", "Integer overflow in %s", name);
+    }
+    return value;
+}
+
+// < or = of evaluated operands
+int compare(ExprType type, Number left, Number right) {
+    if (pgo_current != NULL) pgo_count_op(left, right);
+    if (left == NUMBER_NONE || right == NUMBER_NONE) {
+        scheme_error("type-error", "%s requires numbers", type == LESS ? "<" : "=");
+    }
+    return number_compare(type, left, right);
+}
+
+Expr *eval(Expr *expr, Environment *env);
+
+// Value of an arithmetic expression, unboxed
+Number eval_number(Expr *expr, Environment *env) {
+    switch (expr->type) {
+        case INT_LITERAL:
+            return number_int(expr->data.int_value);
+        case FLOAT_LITERAL:
+            return number_double(expr->data.float_value);
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY: {
+            Number left = eval_number(expr->data.binop.left, env);
+            return arith(expr->type, left, eval_number(expr->data.binop.right, env));
+        }
+        case ADD_VAR_VAR:
+        case MUL_VAR_VAR: {
+            Number left = number_of(eval_var(expr->data.binop.left->data.var, env));
+            return arith(base_type(expr->type), left, number_of(eval_var(expr->data.binop.right->data.var, env)));
+        }
+        case ADD_VAR_INT:
+        case MUL_VAR_INT:
+            return arith(base_type(expr->type), number_of(eval_var(expr->data.binop.left->data.var, env)),
+                         number_int(expr->data.binop.right->data.int_value));
+        default:
+            return number_of(eval(expr, env));
+    }
+}
+
+#ifdef PROFILE_EVAL
+Expr *eval_node(Expr *expr, Environment *env);
+
+Expr *eval(Expr *expr, Environment *env) {
+    profile_record_step(expr->type);
+    unsigned long long outer_nested = nested_cycles;
+    nested_cycles = 0;
+    unsigned long long start = profile_clock();
+    Expr *result = eval_node(expr, env);
+    unsigned long long total = profile_clock() - start;
+    profile_record(expr->type, total, total > nested_cycles ? total - nested_cycles : 0);
+    nested_cycles = outer_nested + total;
+    return result;
+}
+#else
+#define eval_node eval
+#endif
+
+Expr *eval_node(Expr *expr, Environment *env) {
+    switch (expr->type) {
+        case TRACE_ANCHOR: {
+            Expr *result = trace_enter(expr, &env);
+            return result != NULL ? result : eval(expr->data.trace->body, env);
+        }
+        case GLOBAL_REF:
+            return force(expr->data.global->value);
+        case VAR:
+            return eval_var(expr->data.var, env);
+        case LAMBDA:
+            if (pgo_current != NULL && expr->site == 0) expr->site = pgo_site(pgo_current, -1);
+            return make_closure(expr, env);
+        case APPLY: {
+            Expr *func = eval(expr->data.apply.func, env);
+            Expr *arg = lazy_mode ? delay_arg(expr->data.apply.arg, env) : eval(expr->data.apply.arg, env);
+            return apply_closure(func, arg);
+        }
+        case LIFTED_CALL: {
+            Lifted *lifted = expr->data.lifted;
+            Environment *frame = NULL;
+            for (int i = 0; i < lifted->count; i++) {
+                Expr *arg = lazy_mode ? delay_arg(lifted->args[i], env) : eval(lifted->args[i], env);
+                frame = env_create(lifted->params[i], arg, frame);
+            }
+            return eval(lifted->body, frame);
+        }
+        case APPLY_GLOBAL_VAR: {
+            Expr *func = force(expr->data.apply.func->data.global->value);
+            Expr *arg = lazy_mode ? delay_arg(expr->data.apply.arg, env) : eval_var(expr->data.apply.arg->data.var, env);
+            return apply_closure(func, arg);
+        }
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY:
+        case ADD_VAR_VAR:
+        case ADD_VAR_INT:
+        case MUL_VAR_VAR:
+        case MUL_VAR_INT:
+            return number_box(eval_number(expr, env));
+        case LESS:
+        case NUM_EQUAL: {
+            Number left = eval_number(expr->data.binop.left, env);
+            return make_boolean(compare(expr->type, left, eval_number(expr->data.binop.right, env)));
+        }
+        case IF: {
+            Expr *branches = expr->data.binop.right;
+            int taken = is_true(eval(expr->data.binop.left, env));
+            if (expr->site != 0) pgo_count_branch(expr->site, taken);
+            return eval(taken ? branches->data.binop.left : branches->data.binop.right, env);
+        }
+        case IF_LESS:
+        case IF_NUM_EQUAL: {
+            Expr *test = expr->data.binop.left, *branches = expr->data.binop.right;
+            Number left = eval_number(test->data.binop.left, env);
+            int taken = compare(test->type, left, eval_number(test->data.binop.right, env));
+            if (expr->site != 0) pgo_count_branch(expr->site, taken);
+            return eval(taken ? branches->data.binop.left : branches->data.binop.right, env);
+        }
+        case INT_LITERAL:
+        case FLOAT_LITERAL:
+        case BOOLEAN:
+            return expr;
+        case QUOTE:
+            return expr->data.apply.arg;
+        case DEFINE: {
+            char *var = expr->data.apply.func->data.var;
+            Expr *value = eval(expr->data.apply.arg, env);
+            if (memoize_defines && value->type == CLOSURE) value = make_memo(value);
+            Environment *cell = global_cell(var);
+            if (cell != NULL) {
+                cell->value = value;  // Compiled references see the new value
+            } else {
+                global_env = env_create(var, value, global_env);
+                cell = global_env;
+            }
+            Expr *closure = value->type == MEMO ? value->data.memo->func : value;
+            Expr *source = expr->data.apply.arg;
+            if (source->type == MEMOIZE) source = source->data.apply.arg;
+            // Compiled bodies resolve free variables as globals: a define
+            // inside a lambda makes a closure over its caller's bindings
+            if (inline_enabled && source->type == LAMBDA && closure->type == CLOSURE &&
+                closure->data.closure.lambda == source && closure->data.closure.env == NULL) {
+                compile_definition(cell->var, source);
+            }
+            invalidate_dependents(cell->var);
+            return value;
+        }
+        case TIME: {
+            unsigned long long wall_start = now_ns();
+            unsigned long long cpu_start = cpu_ns();
+            unsigned long long count_start = alloc_count;
+            unsigned long long bytes_start = alloc_bytes;
+            Expr *value = eval(expr->data.apply.arg, env);
+            printf("; wall %.3f ms, cpu %.3f ms, %llu allocations (%llu bytes)\n",
+                   (now_ns() - wall_start) / 1e6, (cpu_ns() - cpu_start) / 1e6,
+                   alloc_count - count_start, alloc_bytes - bytes_start);
+            return value;
+        }
+        case NORMALIZE: {
+            Expr *term = eval(expr->data.apply.arg, env);
+            if (term->type == CLOSURE) {
+                if (term->data.closure.env != NULL) {
+                    scheme_error("type-error", "normalize requires a quoted term or top-level lambda");
+                }
+                term = term->data.closure.lambda;
+            }
+            return nbe_normalize(term);
+        }
+        case EQ: {
+            // Identity, so hash-consed normal forms compare in O(1)
+            Expr *left = eval(expr->data.binop.left, env);
+            Expr *right = eval(expr->data.binop.right, env);
+            return make_boolean(values_equal(left, right));
+        }
+        case DELAY:
+            return make_promise(PROMISE_DELAY, expr->data.apply.arg, env);
+        case DELAY_FORCE:
+            return make_promise(PROMISE_LAZY, expr->data.apply.arg, env);
+        case FORCE: {
+            Expr *value = eval(expr->data.apply.arg, env);
+            return value->type == PROMISE ? force_promise(value) : value;
+        }
+        case PROMISE:
+        case PAIR:
+        case NIL:
+        case MEMO:
+            return expr;
+        case ADAPTON:
+        case CONTINUATION:
+            return expr;
+        case CALLCC:
+        case CALL1CC: {
+            Expr *func = eval(expr->data.apply.arg, env);
+            Expr *k = make_continuation(expr->type == CALL1CC);
+            Continuation *c = k->data.continuation;
+            if (setjmp(c->target) == 0) {
+                c->value = apply_closure(func, k);
+                dynamic_unwind(&c->state);
+            }
+            if (!c->one_shot && c->frames == NULL && continuation_base != NULL) continuation_save(c);
+            return c->value;
+        }
+        case REF:
+            return make_adapton(0, eval(expr->data.apply.arg, env), NULL, NULL);
+        case ADAPT:
+            return make_adapton(1, NULL, expr->data.apply.arg, env);
+        case GET: {
+            Expr *node = eval(expr->data.apply.arg, env);
+            if (node->type != ADAPTON) {
+                scheme_error("type-error", "get requires a ref or adapt value");
+            }
+            return adapt_get(node->data.adapton);
+        }
+        case SET_REF: {
+            Expr *ref = eval(expr->data.binop.left, env);
+            Expr *value = eval(expr->data.binop.right, env);
+            if (ref->type != ADAPTON || ref->data.adapton->is_thunk) {
+                scheme_error("type-error", "set-ref! requires a ref");
+            }
+            AdaptNode *node = ref->data.adapton;
+            if (!values_equal(node->value, value)) {
+                node->value = value;
+                adapt_dirty(node);
+            }
+            return value;
+        }
+        case MEMOIZE: {
+            Expr *func = eval(expr->data.apply.arg, env);
+            if (func->type == MEMO) return func;
+            if (func->type != CLOSURE) {
+                scheme_error("type-error", "memoize requires a procedure");
+            }
+            return make_memo(func);
+        }
+        case CONS:
+            return make_binop(PAIR, eval(expr->data.binop.left, env), eval(expr->data.binop.right, env));
+        case CAR:
+        case CDR: {
+            Expr *pair = eval(expr->data.apply.arg, env);
+            if (pair->type != PAIR) {
+                scheme_error("type-error", "%s requires a pair", expr->type == CAR ? "car" : "cdr");
+            }
+            return expr->type == CAR ? pair->data.binop.left : pair->data.binop.right;
+        }
+        case STREAM_ITERATE: {
+            Expr *func = eval(expr->data.binop.left, env);
+            Expr *stream = make_promise(PROMISE_ITERATE, func, NULL);
+            stream->data.promise->seed = eval(expr->data.binop.right, env);
+            return stream;
+        }
+        case STREAM_REF:
+        case STREAM_TAKE: {
+            Expr *stream = eval(expr->data.binop.left, env);
+            Expr *count = eval(expr->data.binop.right, env);
+            if (count->type != INT_LITERAL || count->data.int_value < 0) {
+                scheme_error("type-error", "Stream index must be a non-negative integer");
+            }
+            int n = count->data.int_value;
+            if (expr->type == STREAM_REF) {
+                for (; n > 0; n--) stream = force_stream(stream)->data.binop.right;
+                return force_stream(stream)->data.binop.left;
+            }
+            Expr *head = &nil, **tail = &head;
+            for (; n > 0; n--) {
+                if (stream->type == PROMISE) stream = force_promise(stream);
+                if (stream->type == NIL) break;  // Shorter stream
+                Expr *pair = force_stream(stream);
+                *tail = make_binop(PAIR, pair->data.binop.left, &nil);
+                tail = &(*tail)->data.binop.right;
+                stream = pair->data.binop.right;
+            }
+            return head;
+        }
+        default:
+            scheme_error("internal", "Unknown expression type");
+    }
+}
+
+char *read_token(char **input) {
+    while (isspace(**input)) (*input)++;
+    char *start = *input;
+    if (isalpha(**input)) {
+        while (isalnum(**input) || (**input != '\0' && strchr("-/?!_<>=*", **input))) (*input)++;
+    } else if (isdigit(**input) || (**input == '.' && isdigit((*input)[1]))) {
+        while (isdigit(**input)) (*input)++;
+        if (**input == '.') {
+            (*input)++;
+            while (isdigit(**input)) (*input)++;
+        }
+        char *exponent = *input + 1;
+        if (*exponent == '+' || *exponent == '-') exponent++;
+        if ((**input == 'e' || **input == 'E') && isdigit(*exponent)) {
+            *input = exponent;
+            while (isdigit(**input)) (*input)++;
+        }
+    } else if (**input == '#' && ((*input)[1] == 't' || (*input)[1] == 'f')) {
+        *input += 2;
+    } else if (**input != '\0' && strchr("()+*-<=", **input)) {
+        (*input)++;
+    }  // Otherwise end of input: return an empty token
+    int length = *input - start;
+    char *token = malloc(length + 1);
+    strncpy(token, start, length);
+    token[length] = '\0';
+    return token;
+}
+
+Expr *parse_expr(char **input);
+
+Expr *parse_list(char **input) {
+    const SpecialForm *form;
+    char *token = read_token(input);
+    if (strcmp(token, "lambda") == 0) {
+        free(token);
+        char *param = read_token(input);
+        Expr *body = parse_expr(input);
+        free(read_token(input));  // consume closing parenthesis
+        return make_lambda(param, body);
+    } else if (strcmp(token, "stream-cons") == 0) {
+        free(token);
+        Expr *head = parse_expr(input);
+        Expr *tail = parse_expr(input);
+        free(read_token(input));  // consume closing parenthesis
+        // (delay (cons head (delay-force tail)))
+        return make_unary(DELAY, make_binop(CONS, head, make_unary(DELAY_FORCE, tail)));
+    } else if (strcmp(token, "stream-car") == 0 || strcmp(token, "stream-cdr") == 0) {
+        ExprType type = token[8] == 'a' ? CAR : CDR;
+        free(token);
+        Expr *stream = parse_expr(input);
+        free(read_token(input));  // consume closing parenthesis
+        return make_unary(type, make_unary(FORCE, stream));
+    } else if (strcmp(token, "if") == 0) {
+        free(token);
+        Expr *test = parse_expr(input);
+        Expr *then = parse_expr(input);
+        Expr *otherwise = parse_expr(input);
+        free(read_token(input));  // consume closing parenthesis
+        return make_if(test, then, otherwise);
+    } else if ((form = find_special_form(token)) != NULL) {
+        free(token);
+        Expr *first = parse_expr(input);
+        Expr *expr = form->arity == 1 ? make_unary(form->type, first) : make_binop(form->type, first, parse_expr(input));
+        free(read_token(input));  // consume closing parenthesis
+        return expr;
+    } else if (strcmp(token, "define") == 0) {
+        free(token);
+        char *var = read_token(input);
+        Expr *value = parse_expr(input);
+        free(read_token(input));  // consume closing parenthesis
+        Expr *expr = scheme_alloc(sizeof(Expr));
+        expr->type = DEFINE;
+        expr->data.apply.func = make_var(var);  // Store variable name
+        expr->data.apply.arg = value;  // Store value
+        return expr;
+    } else {
+        Expr *func;
+        if (token[0] == '(') {
+            func = parse_list(input);  // Computed function, e.g. ((lambda x x) 1)
+        } else {
+            func = make_var(token);
+        }
+        free(token);
+        Expr *arg = parse_expr(input);
+        free(read_token(input));  // consume closing parenthesis
+        return make_apply(func, arg);
+    }
+}
+
+Expr *parse_expr(char **input) {
+    char *token = read_token(input);
+    if (token[0] == '(') {
+        free(token);
+        return parse_list(input);
+    } else if (strcmp(token, "nil") == 0) {
+        free(token);
+        return &nil;
+    } else if (token[0] == '#') {
+        Expr *boolean = make_boolean(token[1] == 't');
+        free(token);
+        return boolean;
+    } else if (isdigit(token[0]) || (token[0] == '.' && isdigit(token[1]))) {
+        Expr *number;
+        if (strpbrk(token, ".eE") != NULL) number = make_float(strtod(token, NULL));
+        else number = make_int(atoi(token));
+        free(token);
+        return number;
+    } else {
+        Expr *var = make_var(token);
+        free(token);
+        return var;
+    }
+}
+
+void print_expr(FILE *out, Expr *expr) {
+    switch (base_type(expr->type)) {
+        case TRACE_ANCHOR:
+            print_expr(out, expr->data.trace->body);
+            break;
+        case LIFTED_CALL:
+            print_expr(out, lifted_source(expr));
+            break;
+        case VAR:
+            fprintf(out, "%s", expr->data.var);
+            break;
+        case GLOBAL_REF:
+            fprintf(out, "%s", expr->data.global->var);
+            break;
+        case LAMBDA:
+            fprintf(out, "(lambda %s ", expr->data.lambda.param);
+            print_expr(out, expr->data.lambda.body);
+            fprintf(out, ")");
+            break;
+        case APPLY:
+            fprintf(out, "(");
+            print_expr(out, expr->data.apply.func);
+            fprintf(out, " ");
+            print_expr(out, expr->data.apply.arg);
+            fprintf(out, ")");
+            break;
+        case INT_LITERAL:
+            fprintf(out, "%d", expr->data.int_value);
+            break;
+        case FLOAT_LITERAL: {
+            char buf[32];
+            format_double(buf, sizeof(buf), expr->data.float_value);
+            fprintf(out, "%s", buf);
+            break;
+        }
+        case PAIR:
+            fprintf(out, "(");
+            print_expr(out, expr->data.binop.left);
+            for (expr = expr->data.binop.right; expr->type == PAIR; expr = expr->data.binop.right) {
+                fprintf(out, " ");
+                print_expr(out, expr->data.binop.left);
+            }
+            if (expr->type != NIL) {
+                fprintf(out, " . ");
+                print_expr(out, expr);
+            }
+            fprintf(out, ")");
+            break;
+        case NIL:
+            fprintf(out, "()");
+            break;
+        case BOOLEAN:
+            fprintf(out, expr->data.int_value ? "#t" : "#f");
+            break;
+        case IF:
+            fprintf(out, "(if ");
+            print_expr(out, expr->data.binop.left);
+            fprintf(out, " ");
+            print_expr(out, expr->data.binop.right->data.binop.left);
+            fprintf(out, " ");
+            print_expr(out, expr->data.binop.right->data.binop.right);
+            fprintf(out, ")");
+            break;
+        case PROMISE:
+            fprintf(out, "#<promise>");
+            break;
+        case ADAPTON:
+            fprintf(out, expr->data.adapton->is_thunk ? "#<adapt>" : "#<ref>");
+            break;
+        case DEFINE:
+            fprintf(out, "(define %s ", expr->data.apply.func->data.var);
+            print_expr(out, expr->data.apply.arg);
+            fprintf(out, ")");
+            break;
+        case CLOSURE:
+        case MEMO:
+            fprintf(out, "#<procedure>");
+            break;
+        case CONTINUATION:
+            fprintf(out, "#<continuation>");
+            break;
+        case THUNK:
+            fprintf(out, "#<thunk>");
+            break;
+        default: {
+            const SpecialForm *form = special_form_of(base_type(expr->type));
+            fprintf(out, "(%s ", form->name);
+            if (form->arity == 1) {
+                print_expr(out, expr->data.apply.arg);
+            } else {
+                print_expr(out, expr->data.binop.left);
+                fprintf(out, " ");
+                print_expr(out, expr->data.binop.right);
+            }
+            fprintf(out, ")");
+            break;
+        }
+    }
+}
+
+// Interaction-net backend (--optimal). A pure lambda term is translated into
+// symmetric interaction combinators: lambda and application share one binary
+// constructor, erasers mark unused variables and each extra use of a variable
+// goes through a duplicator. The net is reduced by local rewrites until no
+// active pair is left and the normal form is read back. Duplicators copy
+// shared subterms incrementally, so work that substitution would repeat for
+// every copy is done once. This is Lamping's abstract algorithm without the
+// bracket oracle, which is correct for terms typable in elementary affine
+// logic (EAL) as long as each duplicator is labelled with the box depth of
+// the contraction it stands for: duplicators of one depth annihilate, of
+// different depths commute. So the term is typed first and the labels come
+// from its typing. The typing is propositional; top-level lambdas are
+// inlined, so each use of one is typed afresh, but a lambda-bound variable
+// has one type. A term with no such typing, e.g. ((lambda c ((c c) I)) two),
+// is rejected with a type error rather than reduced to a net that could not
+// be read back.
+//
+// Rewrites run on net_threads workers, the REPL thread and helper threads.
+// Each keeps the redexes it creates in its own lock-free work-stealing deque
+// and takes from it; a worker whose deque is empty steals from another's. A
+// rewrite touches its two nodes and their neighbours only, so it try-locks
+// those and goes back on the deque if another rewrite holds one; the nodes it
+// creates stay locked until it is done. Every complete reduction of a net
+// has the same number of interactions, so the count printed does not depend
+// on the schedule.
+typedef enum { NET_ROOT, NET_ERA, NET_CON, NET_DUP, NET_FREE } NetKind;
+
+typedef struct {
+    NetKind kind;
+    int label;         // Duplicator depth, 0 for other nodes
+    int ports[3];      // Port each of ours is wired to; port 0 is the principal port
+    atomic_int lock;   // Held by the rewrite touching the node
+    char *name;        // Free variable name, or bound name during read-back
+} NetNode;
+
+typedef struct NetBinder {
+    char *name;
+    int lambda;  // Constructor node of the binding lambda
+    int tail;    // Port the next occurrence is split from
+    int uses;
+    int depth;   // EAL depth variable of the lambda
+    int type;    // EAL type of the parameter
+    struct NetBinder *next;
+} NetBinder;
+
+typedef struct {
+    int *items;
+    int count;
+    int capacity;
+} NetStack;
+
+typedef struct NetRing {
+    long capacity;          // A power of two
+    struct NetRing *older;  // The ring this one replaced, freed after the reduction
+    _Atomic uint64_t items[];
+} NetRing;
+
+// Chase-Lev deque: the owner pushes and takes at the bottom, thieves steal
+// from the top, and only the last item needs a compare-and-swap
+typedef struct {
+    atomic_long top, bottom;
+    _Atomic(NetRing *) ring;
+} NetDeque;
+
+typedef struct {
+    NetDeque redexes;     // Pairs of nodes whose principal ports meet
+    int free_list;        // Released nodes, linked through ports[0]
+    int fresh, fresh_end; // Unused nodes of the chunk it allocates from
+    long interactions, flushed;
+    int held[12];         // Nodes locked by the running rewrite
+    int held_count;
+    unsigned seed;        // Picks whom to steal from
+    pthread_t thread;
+    char padding[64];     // Keeps workers' counters off each other's cache lines
+} NetWorker;
+
+#define NET_PORT(node, slot) ((node) * 4 + (slot))
+#define NET_NODE(port) ((port) >> 2)
+#define NET_SLOT(port) ((port) & 3)
+#define NET_MAX_INTERACTIONS 100000000L
+#define NET_MAX_EXPANSION 64
+#define NET_MAX_READBACK_DEPTH 10000
+#define NET_MAX_READBACK_SIZE 10000000
+#define NET_MAX_THREADS 64
+#define NET_CHUNK_BITS 16
+// Worker 0 stops a reduction whose net has grown past NET_MAX_NODES; ports
+// are ints, so the store could not go past 1 << 29 nodes anyway
+#define NET_MAX_NODES (1 << 25)
+#define NET_MAX_CHUNKS (1 << (29 - NET_CHUNK_BITS))
+#define NET_POLL_PERIOD 1024
+#define NET_AT(node) net_chunks[(node) >> NET_CHUNK_BITS][(node) & ((1 << NET_CHUNK_BITS) - 1)]
+
+static int optimal_mode;  // --optimal
+static int net_threads;   // --net-threads, 0 for one per online CPU
+static NetNode *net_chunks[NET_MAX_CHUNKS];
+static atomic_int net_chunk_count;
+static NetWorker *net_workers;
+static int net_worker_count;
+static __thread NetWorker *net_self;
+static atomic_int net_idle, net_halt;
+static atomic_long net_total;  // Interactions flushed by the workers
+static long net_polled;        // net_total at worker 0's last poll
+static NetStack net_dups;      // Duplicators, labelled with depth variables until solved
+static NetStack *net_labels;   // Per-depth duplicator paths during read-back
+static int net_label_count;
+static int net_fresh_names;
+static long net_readback_left;  // Nodes read back before giving up on the normal form
+
+void net_push(NetStack *stack, int item) {
+    if (stack->count == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 64;
+        stack->items = realloc(stack->items, stack->capacity * sizeof(int));
+    }
+    stack->items[stack->count++] = item;
+}
+
+NetRing *net_ring(long capacity) {
+    NetRing *ring = malloc(sizeof(NetRing) + capacity * sizeof(uint64_t));
+    ring->capacity = capacity;
+    ring->older = NULL;
+    return ring;
+}
+
+void net_deque_push(NetDeque *deque, uint64_t item) {
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    NetRing *ring = atomic_load_explicit(&deque->ring, memory_order_relaxed);
+    if (bottom - top >= ring->capacity) {
+        // Thieves may still read the old ring, so it is only freed once the reduction is over
+        NetRing *grown = net_ring(2 * ring->capacity);
+        for (long i = top; i < bottom; i++) {
+            uint64_t moved = atomic_load_explicit(&ring->items[i & (ring->capacity - 1)], memory_order_relaxed);
+            atomic_store_explicit(&grown->items[i & (grown->capacity - 1)], moved, memory_order_relaxed);
+        }
+        grown->older = ring;
+        atomic_store_explicit(&deque->ring, grown, memory_order_release);
+        ring = grown;
+    }
+    atomic_store_explicit(&ring->items[bottom & (ring->capacity - 1)], item, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+}
+
+int net_deque_take(NetDeque *deque, uint64_t *item) {
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    NetRing *ring = atomic_load_explicit(&deque->ring, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+    if (top > bottom) {
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return 0;
+    }
+    *item = atomic_load_explicit(&ring->items[bottom & (ring->capacity - 1)], memory_order_relaxed);
+    if (top < bottom) return 1;
+    // The last item: whoever moves top first has it
+    int won = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                      memory_order_seq_cst, memory_order_relaxed);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return won;
+}
+
+int net_deque_steal(NetDeque *deque, uint64_t *item) {
+    long top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) return 0;
+    NetRing *ring = atomic_load_explicit(&deque->ring, memory_order_acquire);
+    *item = atomic_load_explicit(&ring->items[top & (ring->capacity - 1)], memory_order_relaxed);
+    return atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                   memory_order_seq_cst, memory_order_relaxed);
+}
+
+long net_deque_size(NetDeque *deque) {
+    return atomic_load(&deque->bottom) - atomic_load(&deque->top);
+}
+
+int net_new(NetKind kind, int label) {
+    NetWorker *self = net_self;
+    int node;
+    if (self->free_list >= 0) {
+        node = self->free_list;
+        self->free_list = NET_AT(node).ports[0];
+    } else {
+        if (self->fresh == self->fresh_end) {
+            int chunk = atomic_fetch_add(&net_chunk_count, 1);
+            if (chunk >= NET_MAX_CHUNKS) {
+                fprintf(stderr, "Interaction net out of nodes\n");
+                exit(EXIT_FAILURE);
+            }
+            if (net_chunks[chunk] == NULL) net_chunks[chunk] = malloc(sizeof(NetNode) << NET_CHUNK_BITS);
+            self->fresh = chunk << NET_CHUNK_BITS;
+            self->fresh_end = self->fresh + (1 << NET_CHUNK_BITS);
+        }
+        node = self->fresh++;
+    }
+    NetNode *n = &NET_AT(node);
+    n->kind = kind;
+    n->label = label;
+    n->ports[0] = n->ports[1] = n->ports[2] = -1;
+    atomic_store_explicit(&n->lock, 0, memory_order_relaxed);
+    n->name = NULL;
+    return node;
+}
+
+// A node made by a rewrite stays locked until the rewrite is done, so a thief
+// that takes one of the redexes it is part of backs off
+int net_spawn(NetKind kind, int label) {
+    int node = net_new(kind, label);
+    atomic_store_explicit(&NET_AT(node).lock, 1, memory_order_relaxed);
+    net_self->held[net_self->held_count++] = node;
+    return node;
+}
+
+void net_release(int node) {
+    NET_AT(node).ports[0] = net_self->free_list;
+    net_self->free_list = node;
+}
+
+int net_try_lock(int node) {
+    NetWorker *self = net_self;
+    for (int i = 0; i < self->held_count; i++) {
+        if (self->held[i] == node) return 1;
+    }
+    int expected = 0;
+    if (!atomic_compare_exchange_strong_explicit(&NET_AT(node).lock, &expected, 1,
+                                                 memory_order_acquire, memory_order_relaxed)) return 0;
+    self->held[self->held_count++] = node;
+    return 1;
+}
+
+void net_unlock(void) {
+    NetWorker *self = net_self;
+    for (int i = 0; i < self->held_count; i++) {
+        atomic_store_explicit(&NET_AT(self->held[i]).lock, 0, memory_order_release);
+    }
+    self->held_count = 0;
+}
+
+int net_target(int port) {
+    return NET_AT(NET_NODE(port)).ports[NET_SLOT(port)];
+}
+
+void net_link(int a, int b) {
+    NET_AT(NET_NODE(a)).ports[NET_SLOT(a)] = b;
+    NET_AT(NET_NODE(b)).ports[NET_SLOT(b)] = a;
+    if (NET_SLOT(a) != 0 || NET_SLOT(b) != 0) return;
+    NetKind ka = NET_AT(NET_NODE(a)).kind, kb = NET_AT(NET_NODE(b)).kind;
+    // A constructor facing a free variable is a stuck application, not a redex
+    if ((ka == NET_FREE && kb != NET_ERA && kb != NET_DUP) ||
+        (kb == NET_FREE && ka != NET_ERA && ka != NET_DUP)) return;
+    net_deque_push(&net_self->redexes, (uint64_t)NET_NODE(a) << 32 | (uint32_t)NET_NODE(b));
+}
+
+// The rewrites below re-read each wire right before relinking it, so wires
+// between the two interacting nodes (e.g. the identity's own body) resolve
+// through the links made earlier in the same rewrite.
+void net_annihilate(int a, int b) {
+    net_link(net_target(NET_PORT(a, 1)), net_target(NET_PORT(b, 1)));
+    net_link(net_target(NET_PORT(a, 2)), net_target(NET_PORT(b, 2)));
+    net_release(a);
+    net_release(b);
+}
+
+void net_commute(int a, int b) {
+    int a1 = net_spawn(NET_AT(a).kind, NET_AT(a).label);
+    int a2 = net_spawn(NET_AT(a).kind, NET_AT(a).label);
+    int b1 = net_spawn(NET_AT(b).kind, NET_AT(b).label);
+    int b2 = net_spawn(NET_AT(b).kind, NET_AT(b).label);
+    net_link(NET_PORT(a1, 0), net_target(NET_PORT(b, 1)));
+    net_link(NET_PORT(a2, 0), net_target(NET_PORT(b, 2)));
+    net_link(NET_PORT(b1, 0), net_target(NET_PORT(a, 1)));
+    net_link(NET_PORT(b2, 0), net_target(NET_PORT(a, 2)));
+    net_link(NET_PORT(a1, 1), NET_PORT(b1, 1));
+    net_link(NET_PORT(a1, 2), NET_PORT(b2, 1));
+    net_link(NET_PORT(a2, 1), NET_PORT(b1, 2));
+    net_link(NET_PORT(a2, 2), NET_PORT(b2, 2));
+    net_release(a);
+    net_release(b);
+}
+
+// Replace node with two copies of leaf (an eraser or a free variable) on its auxiliary wires
+void net_distribute(int node, int leaf) {
+    int c1 = net_spawn(NET_AT(leaf).kind, 0);
+    int c2 = net_spawn(NET_AT(leaf).kind, 0);
+    NET_AT(c1).name = NET_AT(c2).name = NET_AT(leaf).name;
+    net_link(NET_PORT(c1, 0), net_target(NET_PORT(node, 1)));
+    net_link(NET_PORT(c2, 0), net_target(NET_PORT(node, 2)));
+    net_release(node);
+    net_release(leaf);
+}
+
+void net_interact(int a, int b) {
+    if (NET_AT(a).kind > NET_AT(b).kind) {
+        int swap = a;
+        a = b;
+        b = swap;
+    }
+    NetKind ka = NET_AT(a).kind, kb = NET_AT(b).kind;
+    if (ka == NET_ERA && (kb == NET_ERA || kb == NET_FREE)) {
+        net_release(a);
+        net_release(b);
+    } else if (ka == NET_ERA) {
+        net_distribute(b, a);
+    } else if (kb == NET_FREE) {
+        net_distribute(a, b);  // Duplicating a free variable
+    } else if (ka == kb && NET_AT(a).label == NET_AT(b).label) {
+        net_annihilate(a, b);
+    } else {
+        net_commute(a, b);
+    }
+}
+
+// One rewrite, or back on the deque if another worker holds a node it touches
+void net_reduce(NetWorker *self, uint64_t redex) {
+    int a = (int)(redex >> 32), b = (int)(uint32_t)redex;
+    int locked = net_try_lock(a) && net_try_lock(b);
+    for (int i = 0; locked && i < 2; i++) {
+        NetNode *node = &NET_AT(i ? b : a);
+        if (node->kind != NET_CON && node->kind != NET_DUP) continue;
+        locked = net_try_lock(NET_NODE(node->ports[1])) && net_try_lock(NET_NODE(node->ports[2]));
+    }
+    if (locked) {
+        net_interact(a, b);
+        if (++self->interactions - self->flushed == 256) {
+            atomic_fetch_add(&net_total, 256);
+            self->flushed = self->interactions;
+        }
+    }
+    net_unlock();
+    if (!locked) {
+        net_deque_push(&self->redexes, redex);
+        sched_yield();
+    }
+}
+
+// Worker 0's share of the safepoints: charges the interactions flushed since
+// its last poll to the budget and stops every worker once a budget or limit
+// is spent, for net_normalize to raise the error on the REPL thread
+void net_poll(void) {
+    long total = atomic_load(&net_total);
+    safepoint_countdown -= total - net_polled;
+    net_polled = total;
+    if (safepoint_countdown <= 0 && !budget_spent()) budget_check();
+    if (safepoint_countdown <= 0 || total >= NET_MAX_INTERACTIONS ||
+        atomic_load(&net_chunk_count) >= NET_MAX_NODES >> NET_CHUNK_BITS) atomic_store(&net_halt, 1);
+}
+
+// Whether no deque has a redex left, including those of workers that could not be started
+int net_drained(void) {
+    for (int i = 0; i < net_worker_count; i++) {
+        if (net_deque_size(&net_workers[i].redexes) > 0) return 0;
+    }
+    return 1;
+}
+
+// Reduce until every worker is idle with nothing left to steal, or until halted
+void *net_work(void *arg) {
+    NetWorker *self = arg;
+    net_self = self;
+    int idle = 0;
+    for (long round = 1; !atomic_load_explicit(&net_halt, memory_order_relaxed); round++) {
+        if (self == net_workers && round % NET_POLL_PERIOD == 0) net_poll();
+        uint64_t redex;
+        if (!idle && net_deque_take(&self->redexes, &redex)) {
+            net_reduce(self, redex);
+            continue;
+        }
+        // Only its owner pushes to a deque, so an idle worker's stays empty
+        if (!idle) {
+            idle = 1;
+            atomic_fetch_add(&net_idle, 1);
+        }
+        if (atomic_load(&net_idle) == net_worker_count && net_drained()) break;
+        NetWorker *victim = &net_workers[rand_r(&self->seed) % net_worker_count];
+        if (victim == self || net_deque_size(&victim->redexes) <= 0) {
+            sched_yield();
+            continue;
+        }
+        // Busy again before the steal, so that no one sees every worker idle
+        // while the stolen redex is being rewritten
+        atomic_fetch_sub(&net_idle, 1);
+        idle = 0;
+        if (net_deque_steal(&victim->redexes, &redex)) net_reduce(self, redex);
+    }
+    atomic_fetch_add(&net_total, self->interactions - self->flushed);
+    self->flushed = self->interactions;
+    return NULL;
+}
+
+// Fresh workers and an empty node store for the next net; the REPL thread is worker 0
+void net_start(void) {
+    if (net_workers == NULL) {
+        long count = net_threads > 0 ? net_threads : sysconf(_SC_NPROCESSORS_ONLN);
+        net_worker_count = count < 1 ? 1 : count > NET_MAX_THREADS ? NET_MAX_THREADS : (int)count;
+        net_workers = calloc(net_worker_count, sizeof(NetWorker));
+    }
+    for (int i = 0; i < net_worker_count; i++) {
+        NetWorker *worker = &net_workers[i];
+        for (NetRing *ring = atomic_load(&worker->redexes.ring), *older; ring != NULL; ring = older) {
+            older = ring->older;
+            free(ring);
+        }
+        atomic_store(&worker->redexes.top, 0);
+        atomic_store(&worker->redexes.bottom, 0);
+        atomic_store(&worker->redexes.ring, net_ring(1024));
+        worker->free_list = -1;
+        worker->fresh = worker->fresh_end = 0;
+        worker->interactions = worker->flushed = 0;
+        worker->held_count = 0;
+        worker->seed = i + 1;
+    }
+    atomic_store(&net_chunk_count, 0);
+    atomic_store(&net_total, 0);
+    net_polled = 0;
+    net_self = &net_workers[0];
+}
+
+// EAL typing. Every syntax node gets a depth, the number of boxes around it,
+// and every type a level, the depth its connective is used at; both are
+// variables of a system of difference constraints. A lambda's arrow is at the
+// lambda's depth and an application uses its function's arrow at its own
+// depth, while an argument or a body may sit in more boxes than its parent. A
+// term's type is used no shallower than the term, and a variable used twice
+// is contracted where it is bound, so its type must be a box deeper than its
+// lambda. The constraints read "to is at least from plus weight", weight 0 or
+// 1, and have a solution unless a cycle of them has a weight-1 edge.
+typedef struct {
+    int parent;    // Union-find over unified types
+    int from, to;  // An arrow's argument and result types, -1 for a type variable
+    int level;
+    int seen;      // Occurs-check stamp
+} EalType;
+
+typedef struct {
+    int from, to, weight;
+} EalEdge;
+
+static EalType *eal_types;
+static int eal_type_count, eal_type_capacity;
+static EalEdge *eal_edges;
+static int eal_edge_count, eal_edge_capacity;
+static int eal_var_count, eal_stamp;
+
+int eal_var(void) {
+    return eal_var_count++;
+}
+
+void eal_at_least(int to, int from, int weight) {
+    if (eal_edge_count == eal_edge_capacity) {
+        eal_edge_capacity = eal_edge_capacity ? eal_edge_capacity * 2 : 1024;
+        eal_edges = realloc(eal_edges, eal_edge_capacity * sizeof(EalEdge));
+    }
+    eal_edges[eal_edge_count++] = (EalEdge){ from, to, weight };
+}
+
+void eal_equal(int a, int b) {
+    eal_at_least(a, b, 0);
+    eal_at_least(b, a, 0);
+}
+
+int eal_type(int from, int to) {
+    if (eal_type_count == eal_type_capacity) {
+        eal_type_capacity = eal_type_capacity ? eal_type_capacity * 2 : 1024;
+        eal_types = realloc(eal_types, eal_type_capacity * sizeof(EalType));
+    }
+    int type = eal_type_count++;
+    eal_types[type] = (EalType){ type, from, to, eal_var(), 0 };
+    return type;
+}
+
+int eal_find(int type) {
+    while (eal_types[type].parent != type) {
+        type = eal_types[type].parent = eal_types[eal_types[type].parent].parent;
+    }
+    return type;
+}
+
+int eal_occurs(int var, int type) {
+    type = eal_find(type);
+    if (type == var) return 1;
+    if (eal_types[type].from < 0 || eal_types[type].seen == eal_stamp) return 0;
+    eal_types[type].seen = eal_stamp;
+    return eal_occurs(var, eal_types[type].from) || eal_occurs(var, eal_types[type].to);
+}
+
+// 0 if the two types have different shapes or one would contain itself
+int eal_unify(int a, int b) {
+    a = eal_find(a);
+    b = eal_find(b);
+    if (a == b) return 1;
+    eal_equal(eal_types[a].level, eal_types[b].level);
+    if (eal_types[a].from >= 0 && eal_types[b].from >= 0) {
+        eal_types[a].parent = b;
+        return eal_unify(eal_types[a].from, eal_types[b].from) &&
+               eal_unify(eal_types[a].to, eal_types[b].to);
+    }
+    if (eal_types[a].from >= 0) {
+        int swap = a;
+        a = b;
+        b = swap;
+    }
+    eal_stamp++;
+    if (eal_occurs(a, b)) return 0;
+    eal_types[a].parent = b;
+    return 1;
+}
+
+// Least solution of the constraints, or NULL if there is none. The strongly
+// connected components come out of Tarjan's algorithm in reverse topological
+// order, so walking them backwards visits every constraint's source first.
+int *eal_solve(void) {
+    int n = eal_var_count;
+    int *start = calloc(n + 1, sizeof(int)), *edges = malloc((eal_edge_count + 1) * sizeof(int));
+    for (int e = 0; e < eal_edge_count; e++) start[eal_edges[e].from + 1]++;
+    for (int v = 0; v < n; v++) start[v + 1] += start[v];
+    int *next = malloc((n + 1) * sizeof(int));
+    memcpy(next, start, n * sizeof(int));
+    for (int e = 0; e < eal_edge_count; e++) edges[next[eal_edges[e].from]++] = e;
+
+    int *order = malloc((n + 1) * sizeof(int)), *low = malloc((n + 1) * sizeof(int));
+    int *component = malloc((n + 1) * sizeof(int)), *stack = malloc((n + 1) * sizeof(int));
+    int *path = malloc((n + 1) * sizeof(int));
+    int counter = 0, stacked = 0, components = 0;
+    for (int v = 0; v < n; v++) order[v] = component[v] = -1;
+    for (int root = 0; root < n; root++) {
+        if (order[root] >= 0) continue;
+        int depth = 0;
+        path[depth++] = root;
+        order[root] = low[root] = counter++;
+        stack[stacked++] = root;
+        next[root] = start[root];
+        while (depth > 0) {
+            int v = path[depth - 1];
+            if (next[v] < start[v + 1]) {
+                int w = eal_edges[edges[next[v]++]].to;
+                if (order[w] < 0) {
+                    order[w] = low[w] = counter++;
+                    stack[stacked++] = w;
+                    next[w] = start[w];
+                    path[depth++] = w;
+                } else if (component[w] < 0 && order[w] < low[v]) {
+                    low[v] = order[w];
+                }
+                continue;
+            }
+            depth--;
+            if (depth > 0 && low[v] < low[path[depth - 1]]) low[path[depth - 1]] = low[v];
+            if (low[v] != order[v]) continue;
+            int w;
+            do {
+                w = stack[--stacked];
+                component[w] = components;
+            } while (w != v);
+            components++;
+        }
+    }
+
+    // Longest paths over the components, visiting each one's constraints after its sources'
+    int *members = calloc(components + 1, sizeof(int)), *by_component = malloc((n + 1) * sizeof(int));
+    for (int v = 0; v < n; v++) members[component[v] + 1]++;
+    for (int c = 0; c < components; c++) members[c + 1] += members[c];
+    memcpy(next, members, components * sizeof(int));
+    for (int v = 0; v < n; v++) by_component[next[component[v]]++] = v;
+    int *value = calloc(components + 1, sizeof(int)), feasible = 1;
+    for (int c = components - 1; c >= 0 && feasible; c--) {
+        for (int i = members[c]; i < members[c + 1] && feasible; i++) {
+            int v = by_component[i];
+            for (int e = start[v]; e < start[v + 1]; e++) {
+                EalEdge *edge = &eal_edges[edges[e]];
+                int target = component[edge->to];
+                if (target == c && edge->weight > 0) {
+                    feasible = 0;  // A variable would have to exceed itself
+                    break;
+                }
+                if (value[c] + edge->weight > value[target]) value[target] = value[c] + edge->weight;
+            }
+        }
+    }
+    int *solution = NULL;
+    if (feasible) {
+        solution = malloc((n + 1) * sizeof(int));
+        for (int v = 0; v < n; v++) solution[v] = value[component[v]];
+    }
+    free(start);
+    free(edges);
+    free(next);
+    free(order);
+    free(low);
+    free(component);
+    free(stack);
+    free(path);
+    free(members);
+    free(by_component);
+    free(value);
+    return solution;
+}
+
+int net_encode(Expr *expr, NetBinder *scope, int expansion, int depth, int *type);
+
+int net_encode_global(char *var, Expr *value, int expansion, int depth, int *type) {
+    if (value == NULL) {
+        int free_var = net_new(NET_FREE, 0);
+        NET_AT(free_var).name = var;
+        *type = eal_type(-1, -1);
+        eal_at_least(eal_types[*type].level, depth, 0);
+        return NET_PORT(free_var, 0);
+    }
+    // Inline top-level lambdas; anything else needs the evaluator
+    if (value->type != CLOSURE || value->data.closure.env != NULL || expansion >= NET_MAX_EXPANSION) return -1;
+    return net_encode(value->data.closure.lambda, NULL, expansion + 1, depth, type);
+}
+
+// Returns the port carrying expr's value and sets *type to its EAL type, or
+// returns -1 if expr is not a pure lambda term and -2 if it has no EAL typing
+int net_encode(Expr *expr, NetBinder *scope, int expansion, int depth, int *type) {
+    switch (base_type(expr->type)) {
+        case TRACE_ANCHOR:
+            return net_encode(expr->data.trace->body, scope, expansion, depth, type);
+        case LIFTED_CALL:
+            return net_encode(lifted_source(expr), scope, expansion, depth, type);
+        case VAR: {
+            for (NetBinder *binder = scope; binder != NULL; binder = binder->next) {
+                if (strcmp(binder->name, expr->data.var) != 0) continue;
+                *type = binder->type;
+                eal_at_least(eal_types[binder->type].level, depth, 0);
+                if (++binder->uses == 1) return binder->tail;
+                eal_at_least(eal_types[binder->type].level, binder->depth, 1);
+                // Split the previous occurrence (already wired) off a new duplicator
+                int previous = net_target(binder->tail);
+                int dup = net_new(NET_DUP, binder->depth);
+                net_push(&net_dups, dup);
+                net_link(binder->tail, NET_PORT(dup, 0));
+                net_link(NET_PORT(dup, 1), previous);
+                binder->tail = NET_PORT(dup, 2);
+                return binder->tail;
+            }
+            return net_encode_global(expr->data.var, env_lookup(global_env, expr->data.var), expansion, depth, type);
+        }
+        case GLOBAL_REF:
+            return net_encode_global(expr->data.global->var, expr->data.global->value, expansion, depth, type);
+        case LAMBDA: {
+            int lambda = net_new(NET_CON, 0);
+            NetBinder binder = { expr->data.lambda.param, lambda, NET_PORT(lambda, 1), 0, depth, eal_type(-1, -1), scope };
+            int inner = eal_var(), result;
+            eal_at_least(inner, depth, 0);
+            int body = net_encode(expr->data.lambda.body, &binder, expansion, inner, &result);
+            if (body < 0) return body;
+            net_link(NET_PORT(lambda, 2), body);
+            if (binder.uses == 0) net_link(NET_PORT(lambda, 1), NET_PORT(net_new(NET_ERA, 0), 0));
+            *type = eal_type(binder.type, result);
+            eal_equal(eal_types[*type].level, depth);
+            return NET_PORT(lambda, 0);
+        }
+        case APPLY: {
+            int app = net_new(NET_CON, 0), func_type, arg_type;
+            int func = net_encode(expr->data.apply.func, scope, expansion, depth, &func_type);
+            if (func < 0) return func;
+            net_link(NET_PORT(app, 0), func);
+            int inner = eal_var();
+            eal_at_least(inner, depth, 0);
+            int arg = net_encode(expr->data.apply.arg, scope, expansion, inner, &arg_type);
+            if (arg < 0) return arg;
+            net_link(NET_PORT(app, 1), arg);
+            *type = eal_type(-1, -1);
+            eal_at_least(eal_types[*type].level, depth, 0);
+            int arrow = eal_type(arg_type, *type);
+            eal_equal(eal_types[arrow].level, depth);
+            if (!eal_unify(func_type, arrow)) return -2;
+            return NET_PORT(app, 2);
+        }
+        default:
+            return -1;
+    }
+}
+
+Expr *net_readback(int port, int depth) {
+    SAFEPOINT();
+    if (depth > NET_MAX_READBACK_DEPTH || --net_readback_left < 0) return NULL;
+    int node = NET_NODE(port), slot = NET_SLOT(port);
+    switch (NET_AT(node).kind) {
+        case NET_CON:
+            if (slot == 0) {  // Lambda
+                char name[16];
+                snprintf(name, sizeof(name), "x%d", net_fresh_names++);
+                Expr *lambda = make_lambda(name, NULL);
+                char *outer = NET_AT(node).name;
+                NET_AT(node).name = lambda->data.lambda.param;
+                lambda->data.lambda.body = net_readback(net_target(NET_PORT(node, 2)), depth + 1);
+                NET_AT(node).name = outer;
+                return lambda->data.lambda.body ? lambda : NULL;
+            } else if (slot == 1) {  // Variable bound by this lambda
+                return NET_AT(node).name ? make_var(NET_AT(node).name) : NULL;
+            } else {  // Application result
+                Expr *func = net_readback(net_target(NET_PORT(node, 0)), depth + 1);
+                Expr *arg = func ? net_readback(net_target(NET_PORT(node, 1)), depth + 1) : NULL;
+                return arg ? make_apply(func, arg) : NULL;
+            }
+        case NET_DUP: {
+            NetStack *path = &net_labels[NET_AT(node).label];
+            Expr *result;
+            if (slot == 0) {  // Leave through the copy we entered the matching duplicator from
+                if (path->count == 0) return NULL;
+                int branch = path->items[--path->count];
+                result = net_readback(net_target(NET_PORT(node, branch)), depth + 1);
+                net_push(path, branch);
+            } else {
+                net_push(path, slot);
+                result = net_readback(net_target(NET_PORT(node, 0)), depth + 1);
+                path->count--;
+            }
+            return result;
+        }
+        case NET_FREE:
+            return make_var(NET_AT(node).name);
+        default:
+            return NULL;
+    }
+}
+
+// Normal form of a pure lambda term, or NULL if expr needs the evaluator
+Expr *net_normalize(Expr *expr, long *interactions) {
+    net_start();
+    net_dups.count = 0;
+    net_fresh_names = 0;
+    eal_type_count = eal_edge_count = eal_var_count = 0;
+    int root = net_new(NET_ROOT, 0), type;
+    int term = net_encode(expr, NULL, 0, eal_var(), &type);
+    if (term == -1) return NULL;
+    int *depths = term < 0 ? NULL : eal_solve();
+    if (depths == NULL) {
+        scheme_error("type-error", "--optimal needs a term with an elementary affine logic typing");
+    }
+    net_label_count = 0;
+    for (int i = 0; i < net_dups.count; i++) {
+        NetNode *dup = &NET_AT(net_dups.items[i]);
+        dup->label = depths[dup->label] + 1;
+        if (dup->label > net_label_count) net_label_count = dup->label;
+    }
+    free(depths);
+    net_link(NET_PORT(root, 1), term);
+
+    for (;;) {
+        atomic_store(&net_halt, 0);
+        atomic_store(&net_idle, 0);
+        for (int i = 1; i < net_worker_count; i++) {
+            // A worker that cannot be started counts as idle; the others steal its redexes
+            if (pthread_create(&net_workers[i].thread, NULL, net_work, &net_workers[i]) != 0) {
+                net_workers[i].thread = pthread_self();
+                atomic_fetch_add(&net_idle, 1);
+            }
+        }
+        net_work(&net_workers[0]);
+        for (int i = 1; i < net_worker_count; i++) {
+            if (!pthread_equal(net_workers[i].thread, pthread_self())) pthread_join(net_workers[i].thread, NULL);
+        }
+        if (!atomic_load(&net_halt)) break;
+        if (atomic_load(&net_total) >= NET_MAX_INTERACTIONS) {
+            scheme_error("limit", "Interaction limit exceeded");
+        }
+        if (atomic_load(&net_chunk_count) >= NET_MAX_NODES >> NET_CHUNK_BITS) {
+            scheme_error("limit", "Interaction net grew past %d nodes", NET_MAX_NODES);
+        }
+        if (safepoint_countdown <= 0) budget_check();
+    }
+    *interactions = atomic_load(&net_total);
+
+    net_labels = realloc(net_labels, (net_label_count + 1) * sizeof(NetStack));
+    memset(net_labels, 0, (net_label_count + 1) * sizeof(NetStack));
+    net_readback_left = NET_MAX_READBACK_SIZE;
+    Expr *normal_form = net_readback(net_target(NET_PORT(root, 1)), 0);
+    for (int i = 0; i <= net_label_count; i++) free(net_labels[i].items);
+    if (normal_form == NULL) {
+        scheme_error("limit", "Normal form too large to read back (over %d nodes deep or %d nodes)",
+                     NET_MAX_READBACK_DEPTH, NET_MAX_READBACK_SIZE);
+    }
+    return normal_form;
+}
+
+// Normalization by evaluation (normalize). A quoted lambda term is evaluated
+// into semantic values (closures and neutral terms) and read back to beta-normal
+// form. Bound variables are named after their de Bruijn level, so alpha-equivalent
+// normal forms are the same tree, and the read-back hash-conses every node:
+// equal normal forms are the same pointer and compare with eq in O(1).
+#define NBE_MAX_STEPS 10000000L
+
+typedef enum { NBE_CLOSURE, NBE_LEVEL, NBE_FREE, NBE_APP } NbeKind;
+
+struct NbeEnv;
+
+typedef struct NbeValue {
+    NbeKind kind;
+    union {
+        struct {
+            Expr *lambda;
+            struct NbeEnv *env;
+        } closure;
+        int level;   // Bound variable introduced during read-back
+        char *name;  // Free variable
+        struct {
+            struct NbeValue *func;  // Neutral
+            struct NbeValue *arg;
+        } app;
+    } data;
+} NbeValue;
+
+typedef struct NbeEnv {
+    char *var;
+    NbeValue *value;
+    struct NbeEnv *next;
+} NbeEnv;
+
+static Expr **hashcons_table;
+static size_t hashcons_capacity, hashcons_count;
+static long nbe_steps;
+
+size_t hashcons_hash(ExprType type, const char *name, Expr *left, Expr *right) {
+    size_t hash = (size_t)type * 0x9e3779b97f4a7c15ULL;
+    if (name) {
+        for (const char *c = name; *c; c++) hash = (hash ^ (unsigned char)*c) * 0x100000001b3ULL;
+    }
+    hash = (hash ^ (size_t)left) * 0x100000001b3ULL;
+    hash = (hash ^ (size_t)right) * 0x100000001b3ULL;
+    return hash ^ (hash >> 29);
+}
+
+int hashcons_matches(Expr *expr, ExprType type, const char *name, Expr *left, Expr *right) {
+    if (expr->type != type) return 0;
+    switch (type) {
+        case VAR:
+            return strcmp(expr->data.var, name) == 0;
+        case LAMBDA:
+            return expr->data.lambda.body == left && strcmp(expr->data.lambda.param, name) == 0;
+        default:
+            return expr->data.apply.func == left && expr->data.apply.arg == right;
+    }
+}
+
+// The unique VAR, LAMBDA or APPLY node with these fields
+Expr *hashcons(ExprType type, char *name, Expr *left, Expr *right) {
+    if (2 * (hashcons_count + 1) > hashcons_capacity) {
+        size_t old_capacity = hashcons_capacity;
+        Expr **old_table = hashcons_table;
+        hashcons_capacity = old_capacity ? old_capacity * 2 : 1024;
+        hashcons_table = calloc(hashcons_capacity, sizeof(Expr *));
+        for (size_t i = 0; i < old_capacity; i++) {
+            Expr *e = old_table[i];
+            if (e == NULL) continue;
+            size_t slot = (e->type == VAR ? hashcons_hash(VAR, e->data.var, NULL, NULL)
+                           : e->type == LAMBDA ? hashcons_hash(LAMBDA, e->data.lambda.param, e->data.lambda.body, NULL)
+                           : hashcons_hash(APPLY, NULL, e->data.apply.func, e->data.apply.arg)) & (hashcons_capacity - 1);
+            while (hashcons_table[slot] != NULL) slot = (slot + 1) & (hashcons_capacity - 1);
+            hashcons_table[slot] = e;
+        }
+        free(old_table);
+    }
+    size_t slot = hashcons_hash(type, name, left, right) & (hashcons_capacity - 1);
+    for (; hashcons_table[slot] != NULL; slot = (slot + 1) & (hashcons_capacity - 1)) {
+        if (hashcons_matches(hashcons_table[slot], type, name, left, right)) return hashcons_table[slot];
+    }
+    Expr *expr = type == VAR ? make_var(name) : type == LAMBDA ? make_lambda(name, left) : make_apply(left, right);
+    hashcons_table[slot] = expr;
+    hashcons_count++;
+    return expr;
+}
+
+NbeValue *nbe_value(NbeKind kind) {
+    NbeValue *value = scheme_alloc(sizeof(NbeValue));
+    value->kind = kind;
+    return value;
+}
+
+NbeValue *nbe_eval(Expr *expr, NbeEnv *env);
+
+NbeValue *nbe_apply(NbeValue *func, NbeValue *arg) {
+    if (func->kind != NBE_CLOSURE) {
+        NbeValue *app = nbe_value(NBE_APP);
+        app->data.app.func = func;
+        app->data.app.arg = arg;
+        return app;
+    }
+    SAFEPOINT();
+    if (++nbe_steps > NBE_MAX_STEPS) {
+        scheme_error("limit", "normalize: step limit exceeded (term may have no normal form)");
+    }
+    Expr *lambda = func->data.closure.lambda;
+    NbeEnv *env = scheme_alloc(sizeof(NbeEnv));
+    env->var = lambda->data.lambda.param;
+    env->value = arg;
+    env->next = func->data.closure.env;
+    return nbe_eval(lambda->data.lambda.body, env);
+}
+
+// Top-level lambdas unfold; other names stay free
+NbeValue *nbe_eval_global(char *var, Expr *global) {
+    if (global != NULL && global->type == CLOSURE && global->data.closure.env == NULL) {
+        return nbe_eval(global->data.closure.lambda, NULL);
+    }
+    NbeValue *free_var = nbe_value(NBE_FREE);
+    free_var->data.name = var;
+    return free_var;
+}
+
+NbeValue *nbe_eval(Expr *expr, NbeEnv *env) {
+    switch (base_type(expr->type)) {
+        case TRACE_ANCHOR:
+            return nbe_eval(expr->data.trace->body, env);
+        case LIFTED_CALL:
+            return nbe_eval(lifted_source(expr), env);
+        case VAR: {
+            for (; env != NULL; env = env->next) {
+                if (strcmp(env->var, expr->data.var) == 0) return env->value;
+            }
+            return nbe_eval_global(expr->data.var, env_lookup(global_env, expr->data.var));
+        }
+        case GLOBAL_REF:
+            return nbe_eval_global(expr->data.global->var, expr->data.global->value);
+        case LAMBDA: {
+            NbeValue *closure = nbe_value(NBE_CLOSURE);
+            closure->data.closure.lambda = expr;
+            closure->data.closure.env = env;
+            return closure;
+        }
+        case APPLY: {
+            NbeValue *func = nbe_eval(expr->data.apply.func, env);
+            return nbe_apply(func, nbe_eval(expr->data.apply.arg, env));
+        }
+        default:
+            scheme_error("type-error", "normalize: not a lambda term");
+    }
+}
+
+char *nbe_level_name(int level) {
+    char name[16];
+    snprintf(name, sizeof(name), "x%d", level);
+    return hashcons(VAR, name, NULL, NULL)->data.var;
+}
+
+Expr *nbe_quote(NbeValue *value, int level) {
+    switch (value->kind) {
+        case NBE_CLOSURE: {
+            NbeValue *var = nbe_value(NBE_LEVEL);
+            var->data.level = level;
+            Expr *body = nbe_quote(nbe_apply(value, var), level + 1);
+            return hashcons(LAMBDA, nbe_level_name(level), body, NULL);
+        }
+        case NBE_LEVEL:
+            return hashcons(VAR, nbe_level_name(value->data.level), NULL, NULL);
+        case NBE_FREE:
+            return hashcons(VAR, value->data.name, NULL, NULL);
+        default: {
+            Expr *func = nbe_quote(value->data.app.func, level);
+            return hashcons(APPLY, NULL, func, nbe_quote(value->data.app.arg, level));
+        }
+    }
+}
+
+Expr *nbe_normalize(Expr *term) {
+    nbe_steps = 0;
+    return nbe_quote(nbe_eval(term, NULL), 0);
+}
+
+// Log-linear (HDR-style) latency histogram: exact below 32ns, then 16 sub-buckets
+// per power of two, so every recorded value is within ~6% of its bucket.
+#define LATENCY_SUB_BITS 5
+#define LATENCY_HALF (1 << (LATENCY_SUB_BITS - 1))
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 2) * LATENCY_HALF)
+
+typedef struct {
+    const char *name;
+    unsigned long long count;
+    unsigned long long sum;
+    unsigned long long max;
+    unsigned long long buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+static LatencyHistogram parse_latency = { .name = "parse" };
+static LatencyHistogram eval_latency = { .name = "eval" };
+static LatencyHistogram print_latency = { .name = "print" };
+
+static const char *metrics_path;  // --metrics FILE
+static unsigned long long start_time;
+
+int latency_index(unsigned long long ns) {
+    if (ns < (1ULL << LATENCY_SUB_BITS)) return (int)ns;
+    int shift = 63 - __builtin_clzll(ns) - (LATENCY_SUB_BITS - 1);
+    return shift * LATENCY_HALF + (int)(ns >> shift);
+}
+
+unsigned long long latency_bucket_max(int index) {
+    if (index < (1 << LATENCY_SUB_BITS)) return index;
+    int shift = index / LATENCY_HALF - 1;
+    unsigned long long mantissa = index % LATENCY_HALF + LATENCY_HALF;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void latency_record(LatencyHistogram *h, unsigned long long ns) {
+    h->count++;
+    h->sum += ns;
+    if (ns > h->max) h->max = ns;
+    h->buckets[latency_index(ns)]++;
+}
+
+unsigned long long latency_percentile(LatencyHistogram *h, double p) {
+    unsigned long long rank = (unsigned long long)(p * h->count + 0.5);
+    if (rank == 0) rank = 1;
+    unsigned long long seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            unsigned long long value = latency_bucket_max(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
+
+void metrics_write_histogram(FILE *out, LatencyHistogram *h) {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    fprintf(out, "# TYPE scheme_%s_latency_ns summary\n", h->name);
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        fprintf(out, "scheme_%s_latency_ns{quantile=\"%g\"} %llu\n", h->name, quantiles[i],
+                h->count ? latency_percentile(h, quantiles[i]) : 0);
+    }
+    fprintf(out, "scheme_%s_latency_ns_max %llu\n", h->name, h->max);
+    fprintf(out, "scheme_%s_latency_ns_sum %llu\n", h->name, h->sum);
+    fprintf(out, "scheme_%s_latency_ns_count %llu\n", h->name, h->count);
+}
+
+// Rewrite the metrics file; the rename keeps readers from seeing a partial file
+void metrics_write(void) {
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", metrics_path);
+    FILE *out = fopen(tmp_path, "w");
+    if (!out) {
+        fprintf(stderr, "Cannot write metrics file: %s\n", tmp_path);
+        return;
+    }
+    double uptime = (now_ns() - start_time) / 1e9;
+    metrics_write_histogram(out, &parse_latency);
+    metrics_write_histogram(out, &eval_latency);
+    metrics_write_histogram(out, &print_latency);
+    fprintf(out, "# TYPE scheme_heap_bytes gauge\nscheme_heap_bytes %llu\n", alloc_bytes);
+    fprintf(out, "# TYPE scheme_allocations_total counter\nscheme_allocations_total %llu\n", alloc_count);
+    fprintf(out, "# TYPE scheme_allocated_bytes_total counter\nscheme_allocated_bytes_total %llu\n", alloc_bytes);
+    fprintf(out, "# TYPE scheme_allocation_rate_bytes_per_second gauge\nscheme_allocation_rate_bytes_per_second %.0f\n",
+            uptime > 0 ? alloc_bytes / uptime : 0.0);
+    fprintf(out, "# TYPE scheme_recompilations_total counter\nscheme_recompilations_total %llu\n", recompilations);
+    fprintf(out, "# TYPE scheme_lifted_call_sites_total counter\nscheme_lifted_call_sites_total %llu\n", lifted_sites);
+    fprintf(out, "# TYPE scheme_jit_traces_total counter\nscheme_jit_traces_total %llu\n", jit_traces);
+    fprintf(out, "# TYPE scheme_jit_loops_total counter\nscheme_jit_loops_total %llu\n", jit_loops);
+    fprintf(out, "# TYPE scheme_jit_optimized_total counter\nscheme_jit_optimized_total %llu\n", jit_optimized);
+    fprintf(out, "# TYPE scheme_jit_side_exits_total counter\nscheme_jit_side_exits_total %llu\n", jit_side_exits);
+    fprintf(out, "# TYPE scheme_errors_total counter\nscheme_errors_total %llu\n", errors_signalled);
+    fprintf(out, "# TYPE scheme_uptime_seconds gauge\nscheme_uptime_seconds %.3f\n", uptime);
+    fclose(out);
+    rename(tmp_path, metrics_path);
+}
+
+void repl() {
+    char input[256];
+    Environment *env = NULL;
+    ErrorHandler handler;
+
+    // A failed request unwinds to here and the loop carries on with the next
+    // one, keeping definitions, caches and compiled code
+    dynamic_save(&handler.state);
+    error_handler = &handler;
+    continuation_base = __builtin_frame_address(0);
+    if (setjmp(handler.target) != 0) {
+        report_condition(&handler.condition);
+        if (metrics_path) metrics_write();
+    }
+    while (1) {
+        printf("> ");
+        if (!fgets(input, sizeof(input), stdin)) break;
+        char *p = input;
+        unsigned long long parse_start = now_ns();
+        PROBE1(parse__start, input);
+        Expr *expr = parse_expr(&p);
+        PROBE1(parse__done, expr);
+        unsigned long long eval_start = now_ns();
+        PROBE1(eval__start, expr);
+        long interactions = 0;
+        budget_start();
+        Expr *normal_form = optimal_mode ? net_normalize(expr, &interactions) : NULL;
+        Expr *result = normal_form ? normal_form : eval(expr, env);
+        PROBE1(eval__done, result);
+        unsigned long long print_start = now_ns();
+        if (normal_form != NULL) {
+            print_expr(stdout, normal_form);
+            printf("\n; %ld interactions\n", interactions);
+        } else if (result->type == INT_LITERAL) {
+            printf("%d\n", result->data.int_value);
+        } else if (result->type != CLOSURE && result->type != THUNK && result->type != MEMO) {
+            print_expr(stdout, result);  // Quoted syntax
+            printf("\n");
+        } else {
+            printf("Expression evaluated.\n");
+        }
+        unsigned long long print_end = now_ns();
+        latency_record(&parse_latency, eval_start - parse_start);
+        latency_record(&eval_latency, print_start - eval_start);
+        latency_record(&print_latency, print_end - print_start);
+        if (metrics_path) metrics_write();
+        // Free memory allocated for the expression (not implemented here)
+    }
+    error_handler = NULL;
+}
+
+int compare_ns(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+
+// --bench N: evaluate each input form N times after a warm-up and print statistics
+void bench(int iterations) {
+    char input[256];
+    Environment *env = NULL;
+    int warmup = iterations / 10 > 0 ? iterations / 10 : 1;
+    unsigned long long *samples = malloc(iterations * sizeof(unsigned long long));
+    ErrorHandler handler;
+
+    dynamic_save(&handler.state);
+    error_handler = &handler;
+    continuation_base = __builtin_frame_address(0);
+    if (setjmp(handler.target) != 0) {
+        input[strcspn(input, "\n")] = '\0';
+        printf("%s\n  error: %s\n", input, handler.condition.message);
+    }
+    while (fgets(input, sizeof(input), stdin)) {
+        char *p = input;
+        while (isspace(*p)) p++;
+        if (*p == '\0') continue;
+        Expr *expr = parse_expr(&p);
+        for (int i = 0; i < warmup; i++) {
+            budget_start();
+            eval(expr, env);
+        }
+        unsigned long long count_start = alloc_count;
+        unsigned long long cpu_start = cpu_ns();
+        double sum = 0;
+        for (int i = 0; i < iterations; i++) {
+            budget_start();
+            unsigned long long start = now_ns();
+            eval(expr, env);
+            samples[i] = now_ns() - start;
+            sum += samples[i];
+        }
+        unsigned long long cpu_total = cpu_ns() - cpu_start;
+        qsort(samples, iterations, sizeof(unsigned long long), compare_ns);
+        input[strcspn(input, "\n")] = '\0';
+        printf("%s\n", input);
+        printf("  %d runs (%d warm-up): min %llu ns, median %llu ns, mean %.0f ns, p99 %llu ns, max %llu ns\n",
+               iterations, warmup, samples[0], samples[iterations / 2], sum / iterations,
+               samples[(int)(iterations * 0.99)], samples[iterations - 1]);
+        printf("  cpu %.0f ns/run, %.1f allocations/run\n",
+               (double)cpu_total / iterations, (double)(alloc_count - count_start) / iterations);
+    }
+    error_handler = NULL;
+    free(samples);
+}
+
+// Synthetic corpus generator and parser throughput benchmark (--bench-parser)
+typedef struct {
+    size_t bytes;          // Approximate corpus size
+    int depth;             // Maximum nesting depth of a form
+    int ident_length;      // Identifier length
+    int numeric_density;   // Percentage of leaves that are numeric literals, a quarter of them floats
+    unsigned long long seed;
+    int passes;
+} CorpusOptions;
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+void buffer_append(Buffer *buf, const char *text, size_t length) {
+    if (buf->length + length + 1 > buf->capacity) {
+        buf->capacity = (buf->length + length + 1) * 2;
+        buf->data = realloc(buf->data, buf->capacity);
+    }
+    memcpy(buf->data + buf->length, text, length);
+    buf->length += length;
+    buf->data[buf->length] = '\0';
+}
+
+unsigned long long corpus_random(unsigned long long *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+void corpus_identifier(Buffer *buf, CorpusOptions *opts, unsigned long long *rng) {
+    static const char *keywords[] = { "lambda", "define", "nil", "stream-cons", "stream-car", "stream-cdr" };
+    static const char alnum[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    char ident[64];
+    int length = opts->ident_length < 1 ? 1 : opts->ident_length > 63 ? 63 : opts->ident_length;
+    while (1) {
+        ident[0] = alnum[corpus_random(rng) % 26];
+        for (int i = 1; i < length; i++) ident[i] = alnum[corpus_random(rng) % 36];
+        ident[length] = '\0';
+        int reserved = 0;
+        for (size_t k = 0; k < sizeof(keywords) / sizeof(keywords[0]); k++) {
+            if (strcmp(ident, keywords[k]) == 0) reserved = 1;
+        }
+        if (find_special_form(ident) != NULL) reserved = 1;
+        if (!reserved) break;
+    }
+    buffer_append(buf, ident, length);
+}
+
+void corpus_expr(Buffer *buf, CorpusOptions *opts, unsigned long long *rng, int depth) {
+    if (depth <= 0 || corpus_random(rng) % 4 == 0) {
+        if ((int)(corpus_random(rng) % 100) < opts->numeric_density) {
+            // One numeric literal in four is a float
+            char number[32];
+            int value = (int)(corpus_random(rng) % 100000);
+            int length = corpus_random(rng) % 4 == 0
+                             ? snprintf(number, sizeof(number), "%d.%02d", value, (int)(corpus_random(rng) % 100))
+                             : snprintf(number, sizeof(number), "%d", value);
+            buffer_append(buf, number, length);
+        } else if (corpus_random(rng) % 8 == 0) {
+            buffer_append(buf, corpus_random(rng) % 2 ? "#t" : "#f", 2);
+        } else {
+            corpus_identifier(buf, opts, rng);
+        }
+        return;
+    }
+    static const char *operators[] = { "(+ ", "(* ", "(- ", "(< ", "(= " };
+    switch (corpus_random(rng) % 6) {
+        case 0:
+            buffer_append(buf, "(lambda ", 8);
+            corpus_identifier(buf, opts, rng);
+            buffer_append(buf, " ", 1);
+            corpus_expr(buf, opts, rng, depth - 1);
+            break;
+        case 1:
+        case 2:
+            buffer_append(buf, operators[corpus_random(rng) % 5], 3);
+            corpus_expr(buf, opts, rng, depth - 1);
+            buffer_append(buf, " ", 1);
+            corpus_expr(buf, opts, rng, depth - 1);
+            break;
+        case 3:
+            buffer_append(buf, "(", 1);
+            corpus_identifier(buf, opts, rng);
+            buffer_append(buf, " ", 1);
+            corpus_expr(buf, opts, rng, depth - 1);
+            break;
+        case 4:
+            buffer_append(buf, "(if ", 4);
+            for (int i = 0; i < 3; i++) {
+                if (i > 0) buffer_append(buf, " ", 1);
+                corpus_expr(buf, opts, rng, depth - 1);
+            }
+            break;
+        default:
+            buffer_append(buf, "(quote ", 7);
+            corpus_expr(buf, opts, rng, depth - 1);
+            break;
+    }
+    buffer_append(buf, ")", 1);
+}
+
+Buffer corpus_generate(CorpusOptions *opts) {
+    Buffer buf = { NULL, 0, 0 };
+    unsigned long long rng = opts->seed ? opts->seed : 1;
+    buffer_append(&buf, "", 0);
+    while (buf.length < opts->bytes) {
+        corpus_expr(&buf, opts, &rng, opts->depth);
+        buffer_append(&buf, "\n", 1);
+    }
+    return buf;
+}
+
+long count_nodes(Expr *expr) {
+    switch (expr->type) {
+        case LAMBDA:
+            return 1 + count_nodes(expr->data.lambda.body);
+        case APPLY:
+        case DEFINE:
+            return 1 + count_nodes(expr->data.apply.func) + count_nodes(expr->data.apply.arg);
+        case IF:
+            return 1 + count_nodes(expr->data.binop.left) + count_nodes(expr->data.binop.right->data.binop.left) +
+                   count_nodes(expr->data.binop.right->data.binop.right);
+        case VAR:
+        case INT_LITERAL:
+        case NIL:
+            return 1;
+        default: {
+            const SpecialForm *form = special_form_of(expr->type);
+            if (form == NULL) return 1;
+            if (form->arity == 1) return 1 + count_nodes(expr->data.apply.arg);
+            return 1 + count_nodes(expr->data.binop.left) + count_nodes(expr->data.binop.right);
+        }
+    }
+}
+
+void bench_parser(CorpusOptions *opts) {
+    Buffer corpus = corpus_generate(opts);
+    double megabytes = corpus.length / 1e6;
+    long tokens = 0, nodes = 0, forms = 0;
+    unsigned long long tokenize_ns = 0, parse_ns = 0, parse_allocs = 0;
+
+    for (int pass = 0; pass < opts->passes; pass++) {
+        char *p = corpus.data;
+        tokens = 0;
+        unsigned long long start = now_ns();
+        while (1) {
+            char *token = read_token(&p);
+            int empty = token[0] == '\0';
+            free(token);
+            if (empty) break;
+            tokens++;
+        }
+        tokenize_ns += now_ns() - start;
+
+        p = corpus.data;
+        nodes = forms = 0;
+        Expr **parsed = malloc((corpus.length / 2 + 1) * sizeof(Expr *));
+        unsigned long long allocs_start = alloc_count;
+        start = now_ns();
+        while (1) {
+            while (isspace(*p)) p++;
+            if (*p == '\0') break;
+            parsed[forms++] = parse_expr(&p);
+        }
+        parse_ns += now_ns() - start;
+        parse_allocs += alloc_count - allocs_start;
+        for (long i = 0; i < forms; i++) nodes += count_nodes(parsed[i]);
+        free(parsed);  // Trees are leaked, as in the REPL
+    }
+
+    double tokenize_s = tokenize_ns / 1e9 / opts->passes;
+    double parse_s = parse_ns / 1e9 / opts->passes;
+    printf("corpus: %zu bytes, %ld forms, %ld tokens, %ld nodes (depth %d, identifiers %d chars, %d%% numeric)\n",
+           corpus.length, forms, tokens, nodes, opts->depth, opts->ident_length, opts->numeric_density);
+    printf("tokenize: %.1f MB/s, %.0f tokens/s\n", megabytes / tokenize_s, tokens / tokenize_s);
+    printf("parse:    %.1f MB/s, %.0f nodes/s\n", megabytes / parse_s, nodes / parse_s);
+    // Each token is a short-lived malloc in read_token; nodes are scheme_alloc'd
+    if (nodes == 0) {
+        printf("allocations/node: n/a (empty corpus)\n");
+    } else {
+        printf("allocations/node: %.2f (%.2f retained, %.2f token buffers)\n",
+               (double)(parse_allocs / opts->passes + tokens) / nodes,
+               (double)parse_allocs / opts->passes / nodes, (double)tokens / nodes);
+    }
+    free(corpus.data);
+}
+
+// Ahead-of-time compiler (--compile-to-c FILE): the forms read from stdin
+// become one self-contained C program. Each lambda becomes a C function over
+// a flat closure of its free variables, globals become C variables, and the
+// small runtime below supplies values, arithmetic and printing with the
+// interpreter's error messages. The program prints what the REPL would for
+// each form. Only the strict core language compiles: lambda, application,
+// define, quote, integers, floats and booleans, +, -, *, <, =, if, time,
+// pairs and nil. An if on < or = branches on the comparison directly.
+static const char *aot_runtime =
+    "#include <stdint.h>\n"
+    "#include <stdio.h>\n"
+    "#include <stdlib.h>\n"
+    "#include <string.h>\n"
+    "#include <time.h>\n"
+    "\n"
+    "// Values are NaN-boxed words: a double is stored as itself, with NaNs\n"
+    "// canonicalized, while ints, booleans and object pointers (48-bit) sit in\n"
+    "// the payload of quiet NaNs that arithmetic never produces, so numbers\n"
+    "// never allocate\n"
+    "typedef uint64_t Value;\n"
+    "typedef Value (*Code)(Value *env, Value arg);\n"
+    "\n"
+    "#define TAG_MASK 0xffff000000000000ULL\n"
+    "#define TAG_INT 0xfff9000000000000ULL\n"
+    "#define TAG_OBJECT 0xfffa000000000000ULL\n"
+    "#define TAG_BOOL 0xfffb000000000000ULL\n"
+    "#define V_UNBOUND TAG_OBJECT  // Null object: a global not defined yet\n"
+    "#define V_FALSE TAG_BOOL\n"
+    "#define V_TRUE (TAG_BOOL | 1)\n"
+    "\n"
+    "enum { T_CLOSURE, T_PAIR, T_NIL, T_SYNTAX };\n"
+    "\n"
+    "typedef struct {\n"
+    "    int tag;\n"
+    "    union {\n"
+    "        struct { Code code; Value *env; } closure;\n"
+    "        struct { Value car, cdr; } pair;\n"
+    "        const char *syntax;\n"
+    "    } u;\n"
+    "} Object;\n"
+    "\n"
+    "static unsigned long long alloc_count, alloc_bytes;\n"
+    "static Object rt_nil_object = { T_NIL, { { 0, 0 } } };\n"
+    "\n"
+    "static inline void rt_error(const char *message) {\n"
+    "    fprintf(stderr, \"%s\\n\", message);\n"
+    "    exit(EXIT_FAILURE);\n"
+    "}\n"
+    "\n"
+    "static inline void *rt_alloc(size_t size) {\n"
+    "    void *p = malloc(size);\n"
+    "    if (p == NULL) rt_error(\"Out of memory\");\n"
+    "    alloc_count++;\n"
+    "    alloc_bytes += size;\n"
+    "    return p;\n"
+    "}\n"
+    "\n"
+    "static inline int rt_is_int(Value v) {\n"
+    "    return (v & TAG_MASK) == TAG_INT;\n"
+    "}\n"
+    "\n"
+    "static inline int rt_is_object(Value v) {\n"
+    "    return (v & TAG_MASK) == TAG_OBJECT;\n"
+    "}\n"
+    "\n"
+    "static inline int rt_is_number(Value v) {\n"
+    "    return !rt_is_object(v) && (v & TAG_MASK) != TAG_BOOL;\n"
+    "}\n"
+    "\n"
+    "static inline Object *rt_object(Value v) {\n"
+    "    return (Object *)(uintptr_t)(v & ~TAG_MASK);\n"
+    "}\n"
+    "\n"
+    "static inline int rt_tag(Value v) {\n"
+    "    return rt_is_object(v) ? rt_object(v)->tag : -1;\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_int(int i) {\n"
+    "    return TAG_INT | (uint32_t)i;\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_double(double d) {\n"
+    "    Value v = 0x7ff8000000000000ULL;\n"
+    "    if (d == d) memcpy(&v, &d, sizeof(v));\n"
+    "    return v;\n"
+    "}\n"
+    "\n"
+    "static inline double rt_double_of(Value v) {\n"
+    "    double d;\n"
+    "    if (rt_is_int(v)) return (int32_t)v;\n"
+    "    memcpy(&d, &v, sizeof(d));\n"
+    "    return d;\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_new(int tag) {\n"
+    "    Object *o = rt_alloc(sizeof(Object));\n"
+    "    o->tag = tag;\n"
+    "    return TAG_OBJECT | (uintptr_t)o;\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_nil(void) {\n"
+    "    return TAG_OBJECT | (uintptr_t)&rt_nil_object;\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_syntax(const char *text) {\n"
+    "    Value v = rt_new(T_SYNTAX);\n"
+    "    rt_object(v)->u.syntax = text;\n"
+    "    return v;\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_closure(Code code, int free_count) {\n"
+    "    Value v = rt_new(T_CLOSURE);\n"
+    "    rt_object(v)->u.closure.code = code;\n"
+    "    rt_object(v)->u.closure.env = free_count ? rt_alloc(free_count * sizeof(Value)) : NULL;\n"
+    "    return v;\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_apply(Value func, Value arg) {\n"
+    "    if (rt_tag(func) != T_CLOSURE) rt_error(\"Attempt to apply non-lambda expression\");\n"
+    "    return rt_object(func)->u.closure.code(rt_object(func)->u.closure.env, arg);\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_global(Value value, const char *name) {\n"
+    "    if (value == V_UNBOUND) {\n"
+    "        fprintf(stderr, \"Unbound variable: %s\\n\", name);\n"
+    "        exit(EXIT_FAILURE);\n"
+    "    }\n"
+    "    return value;\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_arith(char op, Value a, Value b) {\n"
+    "    if (!rt_is_number(a) || !rt_is_number(b)) {\n"
+    "        rt_error(op == '+' ? \"Addition requires numbers\" : op == '-' ? \"Subtraction requires numbers\"\n"
+    "                                                        : \"Multiplication requires numbers\");\n"
+    "    }\n"
+    "    if (rt_is_int(a) && rt_is_int(b)) {\n"
+    "        int i, overflow;\n"
+    "        if (op == '+') overflow = __builtin_add_overflow((int32_t)a, (int32_t)b, &i);\n"
+    "        else if (op == '-') overflow = __builtin_sub_overflow((int32_t)a, (int32_t)b, &i);\n"
+    "        else overflow = __builtin_mul_overflow((int32_t)a, (int32_t)b, &i);\n"
+    "        if (overflow) {\n"
+    "            rt_error(op == '+' ? \"Integer overflow in addition\" : op == '-' ? \"Integer overflow in subtraction\"\n"
+    "                                                           : \"Integer overflow in multiplication\");\n"
+    "        }\n"
+    "        return rt_int(i);\n"
+    "    }\n"
+    "    double x = rt_double_of(a), y = rt_double_of(b);\n"
+    "    return rt_double(op == '+' ? x + y : op == '-' ? x - y : x * y);\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_add(Value a, Value b) {\n"
+    "    return rt_arith('+', a, b);\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_sub(Value a, Value b) {\n"
+    "    return rt_arith('-', a, b);\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_mul(Value a, Value b) {\n"
+    "    return rt_arith('*', a, b);\n"
+    "}\n"
+    "\n"
+    "// a < b or a = b as a C truth value, for branching without a boolean\n"
+    "static inline int rt_compare(char op, Value a, Value b) {\n"
+    "    if (!rt_is_number(a) || !rt_is_number(b)) rt_error(op == '<' ? \"< requires numbers\" : \"= requires numbers\");\n"
+    "    if (rt_is_int(a) && rt_is_int(b)) return op == '<' ? (int32_t)a < (int32_t)b : (int32_t)a == (int32_t)b;\n"
+    "    double x = rt_double_of(a), y = rt_double_of(b);\n"
+    "    return op == '<' ? x < y : x == y;\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_cons(Value car, Value cdr) {\n"
+    "    Value v = rt_new(T_PAIR);\n"
+    "    rt_object(v)->u.pair.car = car;\n"
+    "    rt_object(v)->u.pair.cdr = cdr;\n"
+    "    return v;\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_car(Value pair) {\n"
+    "    if (rt_tag(pair) != T_PAIR) rt_error(\"car requires a pair\");\n"
+    "    return rt_object(pair)->u.pair.car;\n"
+    "}\n"
+    "\n"
+    "static inline Value rt_cdr(Value pair) {\n"
+    "    if (rt_tag(pair) != T_PAIR) rt_error(\"cdr requires a pair\");\n"
+    "    return rt_object(pair)->u.pair.cdr;\n"
+    "}\n"
+    "\n"
+    "static inline double rt_clock_ms(clockid_t clock) {\n"
+    "    struct timespec ts;\n"
+    "    clock_gettime(clock, &ts);\n"
+    "    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;\n"
+    "}\n"
+    "\n"
+    "static inline void rt_write_double(double d) {\n"
+    "    char buf[32];\n"
+    "    if (d != d) {\n"
+    "        printf(\"+nan.0\");\n"
+    "        return;\n"
+    "    }\n"
+    "    if (d == 1.0 / 0.0 || d == -1.0 / 0.0) {\n"
+    "        printf(\"%cinf.0\", d > 0 ? '+' : '-');\n"
+    "        return;\n"
+    "    }\n"
+    "    for (int precision = 1; precision <= 17; precision++) {\n"
+    "        snprintf(buf, sizeof(buf), \"%.*g\", precision, d);\n"
+    "        if (strtod(buf, NULL) == d) break;\n"
+    "    }\n"
+    "    printf(\"%s%s\", buf, strpbrk(buf, \".e\") ? \"\" : \".0\");\n"
+    "}\n"
+    "\n"
+    "static inline void rt_write(Value v) {\n"
+    "    if (rt_is_int(v)) {\n"
+    "        printf(\"%d\", (int32_t)v);\n"
+    "        return;\n"
+    "    }\n"
+    "    if ((v & TAG_MASK) == TAG_BOOL) {\n"
+    "        printf(v == V_FALSE ? \"#f\" : \"#t\");\n"
+    "        return;\n"
+    "    }\n"
+    "    if (!rt_is_object(v)) {\n"
+    "        rt_write_double(rt_double_of(v));\n"
+    "        return;\n"
+    "    }\n"
+    "    switch (rt_tag(v)) {\n"
+    "        case T_CLOSURE: printf(\"#<procedure>\"); break;\n"
+    "        case T_NIL: printf(\"()\"); break;\n"
+    "        case T_SYNTAX: printf(\"%s\", rt_object(v)->u.syntax); break;\n"
+    "        case T_PAIR:\n"
+    "            printf(\"(\");\n"
+    "            rt_write(rt_object(v)->u.pair.car);\n"
+    "            for (v = rt_object(v)->u.pair.cdr; rt_tag(v) == T_PAIR; v = rt_object(v)->u.pair.cdr) {\n"
+    "                printf(\" \");\n"
+    "                rt_write(rt_object(v)->u.pair.car);\n"
+    "            }\n"
+    "            if (rt_tag(v) != T_NIL) {\n"
+    "                printf(\" . \");\n"
+    "                rt_write(v);\n"
+    "            }\n"
+    "            printf(\")\");\n"
+    "            break;\n"
+    "    }\n"
+    "}\n"
+    "\n"
+    "static inline void rt_print(Value v) {\n"
+    "    if (rt_tag(v) == T_CLOSURE) {\n"
+    "        printf(\"Expression evaluated.\\n\");\n"
+    "        return;\n"
+    "    }\n"
+    "    rt_write(v);\n"
+    "    printf(\"\\n\");\n"
+    "}\n";
+
+void buffer_printf(Buffer *buf, const char *format, ...) {
+    char text[1024];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    buffer_append(buf, text, length < (int)sizeof(text) ? (size_t)length : sizeof(text) - 1);
+}
+
+// A lambda being compiled: its parameter and the free variables its closure
+// captures, in env[] order
+typedef struct AotScope {
+    char *param;
+    char **free;
+    int free_count;
+    int uses_param;
+    struct AotScope *outer;
+} AotScope;
+
+typedef struct {
+    Buffer functions;
+    char **globals;
+    int global_count;
+    int temps;
+    int lambdas;
+} Aot;
+
+int aot_global(Aot *aot, char *name) {
+    for (int i = 0; i < aot->global_count; i++) {
+        if (strcmp(aot->globals[i], name) == 0) return i;
+    }
+    aot->globals = realloc(aot->globals, (aot->global_count + 1) * sizeof(char *));
+    aot->globals[aot->global_count] = name;
+    return aot->global_count++;
+}
+
+// Where var lives as seen from scope: "arg", a slot of env, or a global
+void aot_var(Aot *aot, AotScope *scope, char *var, char *out, size_t size) {
+    if (scope == NULL) {
+        int global = aot_global(aot, var);
+        snprintf(out, size, "rt_global(global_%d, \"%s\")", global, var);
+        return;
+    }
+    if (strcmp(scope->param, var) == 0) {
+        scope->uses_param = 1;
+        snprintf(out, size, "arg");
+        return;
+    }
+    for (int i = 0; i < scope->free_count; i++) {
+        if (strcmp(scope->free[i], var) == 0) {
+            snprintf(out, size, "env[%d]", i);
+            return;
+        }
+    }
+    aot_var(aot, scope->outer, var, out, size);
+    if (strncmp(out, "rt_global", 9) == 0) return;
+    scope->free = realloc(scope->free, (scope->free_count + 1) * sizeof(char *));
+    scope->free[scope->free_count] = var;
+    snprintf(out, size, "env[%d]", scope->free_count++);
+}
+
+// Quoted data other than numbers and nil prints as its syntax
+void aot_syntax(Buffer *out, Expr *expr) {
+    char *text;
+    size_t length;
+    FILE *stream = open_memstream(&text, &length);
+    print_expr(stream, expr);
+    fclose(stream);
+    buffer_append(out, "\"", 1);
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '"' || text[i] == '\\') buffer_append(out, "\\", 1);
+        buffer_append(out, &text[i], 1);
+    }
+    buffer_append(out, "\"", 1);
+    free(text);
+}
+
+int aot_expr(Aot *aot, Buffer *out, Expr *expr, AotScope *scope);
+
+// Emit the operands of an if test and write the C condition to test: a
+// comparison is made inline, anything else is compared against #f
+void aot_test(Aot *aot, Buffer *out, Expr *expr, AotScope *scope, char *test, size_t size) {
+    if (expr->type == LESS || expr->type == NUM_EQUAL) {
+        int left = aot_expr(aot, out, expr->data.binop.left, scope);
+        int right = aot_expr(aot, out, expr->data.binop.right, scope);
+        snprintf(test, size, "rt_compare('%c', t%d, t%d)", expr->type == LESS ? '<' : '=', left, right);
+        return;
+    }
+    snprintf(test, size, "t%d != V_FALSE", aot_expr(aot, out, expr, scope));
+}
+
+// Statements of one branch, indented into its block, storing to temporary t
+void aot_branch(Aot *aot, Buffer *out, Expr *expr, AotScope *scope, int t) {
+    Buffer body = { NULL, 0, 0 };
+    int result = aot_expr(aot, &body, expr, scope);
+    for (size_t start = 0; start < body.length;) {
+        char *end = memchr(body.data + start, '\n', body.length - start);
+        size_t length = end - (body.data + start) + 1;
+        buffer_append(out, "    ", 4);
+        buffer_append(out, body.data + start, length);
+        start += length;
+    }
+    buffer_printf(out, "        t%d = t%d;\n", t, result);
+    free(body.data);
+}
+
+// Emit statements computing expr into a fresh temporary and return its
+// number; evaluation order matches eval's left-to-right
+int aot_expr(Aot *aot, Buffer *out, Expr *expr, AotScope *scope) {
+    int t;
+    switch (expr->type) {
+        case INT_LITERAL:
+            t = aot->temps++;
+            buffer_printf(out, "    Value t%d = rt_int(%d);\n", t, expr->data.int_value);
+            return t;
+        case FLOAT_LITERAL:
+            t = aot->temps++;
+            // %a prints inf and nan, which are not C constants
+            if (expr->data.float_value != expr->data.float_value) {
+                buffer_printf(out, "    Value t%d = rt_double(__builtin_nan(\"\"));\n", t);
+            } else if (expr->data.float_value == 1.0 / 0.0 || expr->data.float_value == -1.0 / 0.0) {
+                buffer_printf(out, "    Value t%d = rt_double(%s__builtin_inf());\n", t, expr->data.float_value < 0 ? "-" : "");
+            } else {
+                buffer_printf(out, "    Value t%d = rt_double(%a);\n", t, expr->data.float_value);
+            }
+            return t;
+        case NIL:
+            t = aot->temps++;
+            buffer_printf(out, "    Value t%d = rt_nil();\n", t);
+            return t;
+        case BOOLEAN:
+            t = aot->temps++;
+            buffer_printf(out, "    Value t%d = %s;\n", t, expr->data.int_value ? "V_TRUE" : "V_FALSE");
+            return t;
+        case VAR: {
+            char where[512];
+            aot_var(aot, scope, expr->data.var, where, sizeof(where));
+            t = aot->temps++;
+            buffer_printf(out, "    Value t%d = %s;\n", t, where);
+            return t;
+        }
+        case QUOTE: {
+            Expr *datum = expr->data.apply.arg;
+            if (datum->type == INT_LITERAL || datum->type == FLOAT_LITERAL || datum->type == BOOLEAN || datum->type == NIL) {
+                return aot_expr(aot, out, datum, scope);
+            }
+            t = aot->temps++;
+            buffer_printf(out, "    Value t%d = rt_syntax(", t);
+            aot_syntax(out, datum);
+            buffer_printf(out, ");\n");
+            return t;
+        }
+        case LAMBDA: {
+            AotScope inner = { expr->data.lambda.param, NULL, 0, 0, scope };
+            Buffer body = { NULL, 0, 0 };
+            int result = aot_expr(aot, &body, expr->data.lambda.body, &inner);
+            int id = aot->lambdas++;
+            buffer_printf(&aot->functions, "// (lambda %s ...)\nstatic Value lambda_%d(Value *env, Value arg) {\n",
+                          expr->data.lambda.param, id);
+            if (inner.free_count == 0) buffer_printf(&aot->functions, "    (void)env;\n");
+            if (!inner.uses_param) buffer_printf(&aot->functions, "    (void)arg;\n");
+            buffer_append(&aot->functions, body.data, body.length);
+            buffer_printf(&aot->functions, "    return t%d;\n}\n\n", result);
+            free(body.data);
+            t = aot->temps++;
+            buffer_printf(out, "    Value t%d = rt_closure(lambda_%d, %d);\n", t, id, inner.free_count);
+            for (int i = 0; i < inner.free_count; i++) {
+                char where[512];
+                aot_var(aot, scope, inner.free[i], where, sizeof(where));
+                buffer_printf(out, "    rt_object(t%d)->u.closure.env[%d] = %s;\n", t, i, where);
+            }
+            free(inner.free);
+            return t;
+        }
+        case APPLY:
+        case ADD:
+        case SUBTRACT:
+        case MULTIPLY:
+        case CONS: {
+            int left = aot_expr(aot, out, expr->data.binop.left, scope);
+            int right = aot_expr(aot, out, expr->data.binop.right, scope);
+            const char *op = expr->type == APPLY ? "rt_apply" : expr->type == ADD ? "rt_add" :
+                             expr->type == SUBTRACT ? "rt_sub" : expr->type == MULTIPLY ? "rt_mul" : "rt_cons";
+            t = aot->temps++;
+            buffer_printf(out, "    Value t%d = %s(t%d, t%d);\n", t, op, left, right);
+            return t;
+        }
+        case LESS:
+        case NUM_EQUAL: {
+            char test[64];
+            aot_test(aot, out, expr, scope, test, sizeof(test));
+            t = aot->temps++;
+            buffer_printf(out, "    Value t%d = %s ? V_TRUE : V_FALSE;\n", t, test);
+            return t;
+        }
+        case IF: {
+            Expr *branches = expr->data.binop.right;
+            char test[64];
+            aot_test(aot, out, expr->data.binop.left, scope, test, sizeof(test));
+            t = aot->temps++;
+            buffer_printf(out, "    Value t%d;\n    if (%s) {\n", t, test);
+            aot_branch(aot, out, branches->data.binop.left, scope, t);
+            buffer_printf(out, "    } else {\n");
+            aot_branch(aot, out, branches->data.binop.right, scope, t);
+            buffer_printf(out, "    }\n");
+            return t;
+        }
+        case CAR:
+        case CDR: {
+            int pair = aot_expr(aot, out, expr->data.apply.arg, scope);
+            t = aot->temps++;
+            buffer_printf(out, "    Value t%d = %s(t%d);\n", t, expr->type == CAR ? "rt_car" : "rt_cdr", pair);
+            return t;
+        }
+        case DEFINE: {
+            t = aot_expr(aot, out, expr->data.apply.arg, scope);
+            buffer_printf(out, "    global_%d = t%d;\n", aot_global(aot, expr->data.apply.func->data.var), t);
+            return t;
+        }
+        case TIME: {
+            int id = aot->temps++;
+            buffer_printf(out, "    double wall%d = rt_clock_ms(CLOCK_MONOTONIC), cpu%d = rt_clock_ms(CLOCK_PROCESS_CPUTIME_ID);\n"
+                               "    unsigned long long count%d = alloc_count, bytes%d = alloc_bytes;\n", id, id, id, id);
+            t = aot_expr(aot, out, expr->data.apply.arg, scope);
+            buffer_printf(out, "    printf(\"; wall %%.3f ms, cpu %%.3f ms, %%llu allocations (%%llu bytes)\\n\",\n"
+                               "           rt_clock_ms(CLOCK_MONOTONIC) - wall%d, rt_clock_ms(CLOCK_PROCESS_CPUTIME_ID) - cpu%d,\n"
+                               "           alloc_count - count%d, alloc_bytes - bytes%d);\n", id, id, id, id);
+            return t;
+        }
+        default: {
+            const SpecialForm *form = special_form_of(expr->type);
+            scheme_error("compile", "compile-to-c: %s is not supported", form ? form->name : "this form");
+        }
+    }
+}
+
+// --compile-to-c FILE: compile the forms on stdin into a C program
+int compile_to_c(const char *path) {
+    Aot aot = { { NULL, 0, 0 }, NULL, 0, 0, 0 };
+    Buffer main_body = { NULL, 0, 0 };
+    char input[256];
+    while (fgets(input, sizeof(input), stdin)) {
+        char *p = input;
+        while (isspace(*p)) p++;
+        if (*p == '\0') continue;
+        Expr *expr = parse_expr(&p);
+        int t = aot_expr(&aot, &main_body, expr, NULL);
+        buffer_printf(&main_body, "    rt_print(t%d);\n", t);
+    }
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return 0;
+    }
+    fprintf(out, "// Generated by scheme_repl --compile-to-c\n%s\n", aot_runtime);
+    for (int i = 0; i < aot.global_count; i++) fprintf(out, "static Value global_%d = V_UNBOUND;  // %s\n", i, aot.globals[i]);
+    fprintf(out, "\n%s", aot.functions.data ? aot.functions.data : "");
+    fprintf(out, "int main(void) {\n%s    return 0;\n}\n", main_body.data ? main_body.data : "");
+    fclose(out);
+    free(aot.functions.data);
+    free(aot.globals);
+    free(main_body.data);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    int bench_iterations = 0;
+    int parser_mode = 0;  // 1: --bench-parser, 2: --gen-corpus
+    const char *compile_path = NULL;
+    CorpusOptions corpus = { 1 << 20, 8, 6, 30, 1, 5 };
+    start_time = now_ns();
+    stack_init(__builtin_frame_address(0));
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metrics_path = argv[++i];
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            bench_iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            lazy_mode = 1;
+        } else if (strcmp(argv[i], "--optimal") == 0) {
+            optimal_mode = 1;
+        } else if (strcmp(argv[i], "--net-threads") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            net_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--memo-store") == 0 && i + 1 < argc) {
+            if (!memo_store_open(argv[++i])) return EXIT_FAILURE;
+        } else if (strcmp(argv[i], "--fuel") == 0 && i + 1 < argc && atoll(argv[i + 1]) > 0) {
+            budget.fuel = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--heap-limit") == 0 && i + 1 < argc && atoll(argv[i + 1]) > 0) {
+            budget.heap = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc && atoll(argv[i + 1]) > 0) {
+            budget.timeout_ns = strtoull(argv[++i], NULL, 10) * 1000000ULL;
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            pgo_path = argv[++i];
+        } else if (strcmp(argv[i], "--no-inline") == 0) {
+            inline_enabled = 0;
+        } else if (strcmp(argv[i], "--no-jit") == 0) {
+            jit_enabled = 0;
+        } else if (strcmp(argv[i], "--no-lift") == 0) {
+            lift_enabled = 0;
+        } else if (strcmp(argv[i], "--memoize") == 0) {
+            memoize_defines = 1;
+        } else if (strcmp(argv[i], "--memo-capacity") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            memo_capacity = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--memo-policy") == 0 && i + 1 < argc &&
+                   (strcmp(argv[i + 1], "lru") == 0 || strcmp(argv[i + 1], "clock") == 0)) {
+            memo_policy = strcmp(argv[++i], "lru") == 0 ? MEMO_LRU : MEMO_CLOCK;
+        } else if (strcmp(argv[i], "--compile-to-c") == 0 && i + 1 < argc) {
+            compile_path = argv[++i];
+        } else if (strcmp(argv[i], "--bench-parser") == 0) {
+            parser_mode = 1;
+        } else if (strcmp(argv[i], "--gen-corpus") == 0) {
+            parser_mode = 2;
+        } else if (strcmp(argv[i], "--corpus-bytes") == 0 && i + 1 < argc) {
+            corpus.bytes = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--corpus-depth") == 0 && i + 1 < argc) {
+            corpus.depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ident-length") == 0 && i + 1 < argc) {
+            corpus.ident_length = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--numeric-density") == 0 && i + 1 < argc) {
+            corpus.numeric_density = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            corpus.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--passes") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            corpus.passes = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--lazy] [--optimal] [--no-inline] [--no-lift] [--no-jit] [--memoize] [--memo-capacity N] [--memo-policy lru|clock]\n"
+                            "           [--memo-store FILE] [--metrics FILE] [--profile FILE] [--bench N]\n"
+                            "           [--fuel STEPS] [--heap-limit BYTES] [--timeout MS] [--net-threads N]\n"
+                            "       %s --compile-to-c FILE < program.scm\n"
+                            "       %s --bench-parser|--gen-corpus [--corpus-bytes N] [--corpus-depth D]\n"
+                            "           [--ident-length L] [--numeric-density PCT] [--seed S] [--passes P]\n",
+                    argv[0], argv[0], argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (parser_mode == 1) {
+        bench_parser(&corpus);
+        return 0;
+    } else if (parser_mode == 2) {
+        Buffer text = corpus_generate(&corpus);
+        fwrite(text.data, 1, text.length, stdout);
+        return 0;
+    }
+    if (compile_path != NULL) return compile_to_c(compile_path) ? 0 : EXIT_FAILURE;
+    if (pgo_path != NULL) {
+        pgo_load(pgo_path);
+        atexit(pgo_save);
+    }
+#ifdef PROFILE_EVAL
+    atexit(profile_report);
+#endif
+    if (bench_iterations > 0) {
+        bench(bench_iterations);
+        return 0;
+    }
     repl();
     return 0;
 }
@@ -0,0 +1,13 @@
+(define compose (lambda f (lambda g (lambda x (f (g x))))))
+(define inc (lambda n (+ n 1)))
+(define dbl (lambda n (* n 2)))
+((compose inc) dbl)
+(((compose inc) dbl) 20)
+(define two (lambda f (lambda x (f (f x)))))
+(((two two) inc) 0)
+(cons 1 (cons (quote (a b)) nil))
+(car (cdr (cons 1 (cons 2 nil))))
+(quote (lambda x (x x)))
+(time ((two (two two)) inc) 0)
+(define k (lambda a (lambda b a)))
+((k 3) 4)
@@ -0,0 +1,31 @@
+#t
+#f
+(if #t 1 2)
+(if #f 1 2)
+(if 0 1 2)
+(< 1 2)
+(< 2 1)
+(= 3 3)
+(= 3 3.0)
+(< 1.5 2)
+(- 10 3)
+(- 3 10)
+(- 2.5 1)
+(define sum (lambda n (if (< n 1) 0 (+ n (sum (- n 1))))))
+(sum 10)
+(sum 1000)
+(define fact (lambda n (if (= n 0) 1 (* n (fact (- n 1))))))
+(fact 10)
+(define abs (lambda x (if (< x 0) (- 0 x) x)))
+(abs (- 3 10))
+(define f (lambda x (+ (abs (- x 50)) 1)))
+(f 3)
+(f 70)
+(define count (lambda n (if (< n 100) (count (+ n 1)) n)))
+(count 0)
+(define fib (lambda n (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))))
+(fib 20)
+(quote (if (< a b) c d))
+(define g (lambda x (if (= x 5) (quote five) (quote other))))
+(g 5)
+(g 6)
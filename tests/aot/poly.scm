@@ -0,0 +1,2 @@
+(define f (lambda n (+ (* n (* n n)) (* 3 n))))
+(f 7)
@@ -0,0 +1,12 @@
+(define two (lambda f (lambda x (f (f x)))))
+(define three (lambda f (lambda x (f (f (f x))))))
+(define I (lambda q q))
+((two two) I)
+(three two)
+((lambda c ((c c) I)) two)
+((lambda x (x x)) (lambda x (x x)))
+((two three) g)
+(+ 1 2)
+(define mul (lambda m (lambda n (lambda f (m (n f))))))
+(((mul three) ((mul three) three)) g)
+(((two two) two) g)
@@ -0,0 +1,22 @@
+(define r (ref 1))
+(define t (adapt (if (< (get r) 10) (get r) (car 1))))
+(get t)
+(set-ref! r 20)
+(get t)
+(get t)
+(set-ref! r 3)
+(get t)
+(define u (adapt (+ (get t) 100)))
+(get u)
+(set-ref! r 30)
+(get u)
+(get u)
+(set-ref! r 4)
+(get u)
+(define k (ref 1))
+(define e (adapt (call/cc (lambda esc (+ (get k) (if (< (get k) 5) 0 (esc 0)))))))
+(get e)
+(set-ref! k 7)
+(get e)
+(set-ref! k 2)
+(get e)
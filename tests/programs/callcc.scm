@@ -0,0 +1,14 @@
+(+ 1 (call/cc (lambda k (+ 10 (k 5)))))
+(+ 1 (call/1cc (lambda k 7)))
+(define find (lambda s (call/cc (lambda ret (stream-ref (stream-iterate (lambda n (+ n (ret n))) s) 100)))))
+(find 42)
+(define kk (call/cc (lambda k k)))
+(kk 1)
+kk
+(define upto (lambda n (lambda p (if (< (cdr p) n) ((car p) (cons (car p) (+ (cdr p) 1))) (cdr p)))))
+((upto 5) (call/cc (lambda k (cons k 0))))
+((upto 5) (call/1cc (lambda k (cons k 0))))
+(define deep (lambda n (if (= n 0) (call/cc (lambda k (cons k 0))) (car (cons (deep (- n 1)) 0)))))
+((upto 3) (deep 1000))
+(define once (call/1cc (lambda k k)))
+(once 2)
@@ -0,0 +1,6 @@
+((lambda x (x x)) (lambda x (x x)))
+(define down (lambda n (down (+ n 1))))
+(down 0)
+(+ 1 2)
+(stream-ref (stream-iterate (lambda n (+ n 1)) 0) 100000)
+(stream-ref (stream-iterate (lambda n (+ n 1)) 0) 10)
@@ -0,0 +1,12 @@
+(define id (lambda x x))
+(+ y 1)
+(id 5)
+(car 3)
+(+ 1 (call/cc (lambda k (+ 10 (k 5)))))
+(define kk (call/1cc (lambda k k)))
+(kk 1)
+(define loop (lambda x (x x)))
+(define r (ref 1))
+(get (adapt (+ (get r) (car 1))))
+(get (adapt (+ (get r) 1)))
+(id 7)
@@ -0,0 +1,25 @@
+1.5
+(+ 1.5 2)
+(* 2 0.25)
+(+ 0.1 0.2)
+(* 3 1.0)
+1e300
+(* 1e300 1e300)
+(+ (* 1e300 1e300) (* 0 (* 1e300 1e300)))
+(define area (lambda r (* 3.14159 (* r r))))
+(area 2)
+(area 2.5)
+(quote (1.5 2))
+(define norm (lambda x (lambda y (+ (* x x) (* y y)))))
+((norm 3.0) 4)
+(time ((norm 3.0) 4.5))
+(time (+ (* 1.5 2.5) (* 3.5 4.5)))
+(eq 1.5 1.5)
+(+ 1.5 (quote a))
+(+ 2147483647 0.5)
+(define k 2.5)
+(define useK (lambda x (* x k)))
+(useK 2)
+(define k 3)
+(useK 2)
+.5
@@ -0,0 +1,30 @@
+(define f0 (lambda x (+ x (* (if (< (if (= x x) x x) (* x x)) (- x x) (if (= 16 x) x x)) (- 12 (- x 15))))))
+(define d0 (lambda n (if (< n 1) 0 (+ (f0 (- n 16)) (d0 (- n 1))))))
+(define r0 (lambda k (if (< k 1) 0 (+ (d0 40) (r0 (- k 1))))))
+(r0 40)
+(d0 40)
+(define f1 (lambda x (- (- (if (= (* x 9) (- 9 x)) (+ 10 x) (if (< 8 7) 3 x)) x) (+ x x))))
+(define d1 (lambda n (if (< n 1) 0 (+ (f1 (- n 3)) (d1 (- n 1))))))
+(define r1 (lambda k (if (< k 1) 0 (+ (d1 40) (r1 (- k 1))))))
+(r1 40)
+(d1 40)
+(define f2 (lambda x (if (< (if (< (+ (if (< x x) 19 x) (if (= 17 x) 12 x)) (if (= (if (< 16 x) x x) (- x x)) (if (< x x) x 16) (- x x))) (* (+ x x) 16) x) x) 16 (if (= 6 (+ (if (= 16 x) x 0) (if (= 9 x) 0 x))) 6 (+ (- 18 x) (+ x x))))))
+(define d2 (lambda n (if (< n 1) 0 (+ (f2 (- n 18)) (d2 (- n 1))))))
+(define r2 (lambda k (if (< k 1) 0 (+ (d2 40) (r2 (- k 1))))))
+(r2 40)
+(d2 40)
+(define f3 (lambda x (- (+ (if (= (+ 0 x) (* x x)) (- 15 x) 15) (+ (+ x 5) x)) (+ x x))))
+(define d3 (lambda n (if (< n 1) 0 (+ (f3 (- n 5)) (d3 (- n 1))))))
+(define r3 (lambda k (if (< k 1) 0 (+ (d3 40) (r3 (- k 1))))))
+(r3 40)
+(d3 40)
+(define f4 (lambda x (if (= x (if (< (- (- x 0) (- x x)) (- (* 2 7) (- x x))) (- (+ x 18) (if (< 12 x) 18 x)) (if (= (- 14 x) (+ x x)) (+ 2 x) (- 8 20)))) x (* 9 (if (< (- 6 x) (* x x)) (* 20 12) (if (< 12 x) 16 x))))))
+(define d4 (lambda n (if (< n 1) 0 (+ (f4 (- n 1)) (d4 (- n 1))))))
+(define r4 (lambda k (if (< k 1) 0 (+ (d4 40) (r4 (- k 1))))))
+(r4 40)
+(d4 40)
+(define f5 (lambda x 14))
+(define d5 (lambda n (if (< n 1) 0 (+ (f5 (- n 7)) (d5 (- n 1))))))
+(define r5 (lambda k (if (< k 1) 0 (+ (d5 40) (r5 (- k 1))))))
+(r5 40)
+(d5 40)
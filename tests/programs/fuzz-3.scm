@@ -0,0 +1,30 @@
+(define f0 (lambda x x))
+(define d0 (lambda n (if (< n 1) 0 (+ (f0 (- n 11)) (d0 (- n 1))))))
+(define r0 (lambda k (if (< k 1) 0 (+ (d0 40) (r0 (- k 1))))))
+(r0 40)
+(d0 40)
+(define f1 (lambda x (+ (- (if (= (- x 7) x) (+ 5 x) (* 15 12)) (- (if (= x x) x 13) (- x 17))) (if (= (* (- 10 18) x) (* (if (= x x) x x) (+ 19 x))) (if (= (* x 3) (- 9 x)) (* x x) (- 20 x)) (* (- x 8) (if (= x x) 19 x))))))
+(define d1 (lambda n (if (< n 1) 0 (+ (f1 (- n 1)) (d1 (- n 1))))))
+(define r1 (lambda k (if (< k 1) 0 (+ (d1 40) (r1 (- k 1))))))
+(r1 40)
+(d1 40)
+(define f2 (lambda x (if (= (* (if (< (if (= 8 x) 18 x) (if (= x x) x 18)) (if (< x x) 5 13) (if (= 10 x) x 10)) (- (+ x 10) x)) (* (* (* 13 x) (if (< 15 x) 17 x)) (* (+ x x) x))) (+ x (if (< (+ x 8) (* x 3)) (if (< x x) 20 x) (if (= x x) x x))) x)))
+(define d2 (lambda n (if (< n 1) 0 (+ (f2 (- n 27)) (d2 (- n 1))))))
+(define r2 (lambda k (if (< k 1) 0 (+ (d2 40) (r2 (- k 1))))))
+(r2 40)
+(d2 40)
+(define f3 (lambda x (- (if (= (* (if (= x 4) 0 x) (if (= 19 x) x x)) x) (if (= (if (= x x) x x) (* x 3)) (- 3 10) (+ x x)) 2) x)))
+(define d3 (lambda n (if (< n 1) 0 (+ (f3 (- n 26)) (d3 (- n 1))))))
+(define r3 (lambda k (if (< k 1) 0 (+ (d3 40) (r3 (- k 1))))))
+(r3 40)
+(d3 40)
+(define f4 (lambda x x))
+(define d4 (lambda n (if (< n 1) 0 (+ (f4 (- n 27)) (d4 (- n 1))))))
+(define r4 (lambda k (if (< k 1) 0 (+ (d4 40) (r4 (- k 1))))))
+(r4 40)
+(d4 40)
+(define f5 (lambda x 15))
+(define d5 (lambda n (if (< n 1) 0 (+ (f5 (- n 30)) (d5 (- n 1))))))
+(define r5 (lambda k (if (< k 1) 0 (+ (d5 40) (r5 (- k 1))))))
+(r5 40)
+(d5 40)
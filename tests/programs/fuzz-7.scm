@@ -0,0 +1,30 @@
+(define f0 (lambda x (if (< x (if (< x 2) (+ (+ 18 x) (if (< x 4) 3 9)) (if (< (+ x x) (* 14 x)) (- 2 9) (if (= 9 x) x x)))) x 2)))
+(define d0 (lambda n (if (< n 1) 0 (+ (f0 (- n 18)) (d0 (- n 1))))))
+(define r0 (lambda k (if (< k 1) 0 (+ (d0 40) (r0 (- k 1))))))
+(r0 40)
+(d0 40)
+(define f1 (lambda x (* (- x (+ (if (= 9 12) x x) x)) x)))
+(define d1 (lambda n (if (< n 1) 0 (+ (f1 (- n 23)) (d1 (- n 1))))))
+(define r1 (lambda k (if (< k 1) 0 (+ (d1 40) (r1 (- k 1))))))
+(r1 40)
+(d1 40)
+(define f2 (lambda x x))
+(define d2 (lambda n (if (< n 1) 0 (+ (f2 (- n 2)) (d2 (- n 1))))))
+(define r2 (lambda k (if (< k 1) 0 (+ (d2 40) (r2 (- k 1))))))
+(r2 40)
+(d2 40)
+(define f3 (lambda x 12))
+(define d3 (lambda n (if (< n 1) 0 (+ (f3 (- n 8)) (d3 (- n 1))))))
+(define r3 (lambda k (if (< k 1) 0 (+ (d3 40) (r3 (- k 1))))))
+(r3 40)
+(d3 40)
+(define f4 (lambda x (* (- (if (< x (* x x)) (* 4 16) (- x x)) (- x (if (< x x) x 11))) 6)))
+(define d4 (lambda n (if (< n 1) 0 (+ (f4 (- n 12)) (d4 (- n 1))))))
+(define r4 (lambda k (if (< k 1) 0 (+ (d4 40) (r4 (- k 1))))))
+(r4 40)
+(d4 40)
+(define f5 (lambda x x))
+(define d5 (lambda n (if (< n 1) 0 (+ (f5 (- n 19)) (d5 (- n 1))))))
+(define r5 (lambda k (if (< k 1) 0 (+ (d5 40) (r5 (- k 1))))))
+(r5 40)
+(d5 40)
@@ -0,0 +1,3 @@
+(define y 100)
+((lambda y (define f (lambda x (+ x y)))) 5)
+(f 1)
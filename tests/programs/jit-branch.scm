@@ -0,0 +1,24 @@
+(define clamp (lambda x (if (< x 100) (if (< 10 x) x 10) 100)))
+(define h (lambda x (+ (clamp (* x 3)) (if (= x 7) 1000 (- x 1)))))
+(define w (lambda x (- (* x x) (* 2 x))))
+(define loop (lambda n (if (< n 1) 0 (+ (h n) (+ (w n) (loop (- n 1)))))))
+(loop 400)
+(loop 300)
+(loop 400)
+(loop 400)
+(define sub (lambda x (- 5 (- x (- 1 x)))))
+(define run (lambda n (if (< n 1) 0 (+ (sub n) (run (- n 1))))))
+(run 3000)
+(run 3000)
+(define big (lambda x (* (- x 40000) (- x 40000))))
+(define runb (lambda n (if (< n 1) 0 (+ (big (* n 3)) (runb (- n 1))))))
+(runb 100)
+(runb 400)
+(define e (lambda x (if (= (- x 3) 0) 1 (if (< x 3) 2 (- 0 x)))))
+(define rune (lambda n (if (< n 1) 0 (+ (e (- 6 n)) (rune (- n 1))))))
+(rune 6)
+(rune 6)
+(rune 6)
+(rune 6)
+(define re (lambda n (if (< n 1) 0 (+ (rune 6) (re (- n 1))))))
+(re 1500)
@@ -0,0 +1,29 @@
+(define rep (lambda f (lambda k (if (= k 0) 0 (+ (f 3000) ((rep f) (- k 1)))))))
+(define fsum (lambda n (lambda acc (if (< n 1) acc ((fsum (- n 1)) (+ acc 0.25))))))
+(define fsums (lambda n ((fsum n) 0.5)))
+((rep fsums) 1200)
+(define step (lambda x (+ (* x 0.5) 1.25)))
+(stream-ref (stream-iterate step 0.0) 2000)
+(define half (lambda n (* n 0.5)))
+(define halves (lambda n (lambda acc (if (= n 0) acc ((halves (- n 1)) (+ acc (half n)))))))
+((halves 3000) 0)
+((halves 3000) 0.0)
+(define cmp (lambda x (if (< x 1.0) 1 (if (= x x) 2 3))))
+(define cmps (lambda x (lambda n (lambda acc (if (= n 0) acc (((cmps x) (- n 1)) (+ acc (cmp x))))))))
+(((cmps 0.5) 3000) 0)
+(((cmps 2.0) 3000) 0)
+(define inf (* 1e300 1e300))
+(define nan (* inf 0))
+(((cmps inf) 3000) 0)
+(((cmps nan) 3000) 0)
+(((cmps 1) 3000) 0)
+(((cmps 0.5) 3000) 0)
+(define zero (lambda x (lambda n (lambda acc (if (= n 0) acc (((zero x) (- n 1)) (+ acc (* x 0.0))))))))
+(define zeros (lambda n (((zero inf) n) 0.0)))
+((rep zeros) 1200)
+(define negz (lambda x (lambda n (lambda acc (if (= n 0) acc (((negz x) (- n 1)) (+ (* acc 1.0) (* x 0.0))))))))
+(define negzs (lambda n (((negz (* (- 0.0 1.0) 0.0)) n) (* (- 0.0 1.0) 0.0))))
+(negzs 3000)
+(define mix (lambda a (lambda b (lambda n (if (= n 0) (- a b) (((mix b) (+ a 0.5)) (- n 1)))))))
+(((mix 3) 1.5) 3001)
+(((mix 1.5) 3) 3001)
@@ -0,0 +1,22 @@
+(define count (lambda n (if (= n 0) 7 (count (- n 1)))))
+(define rep (lambda f (lambda k (if (= k 0) 0 (+ (f 3000) ((rep f) (- k 1)))))))
+((rep count) 100)
+((rep count) 1200)
+(define sum (lambda n (lambda acc (if (< n 1) acc ((sum (- n 1)) (+ acc n))))))
+(define sums (lambda n ((sum n) 0)))
+((rep sums) 100)
+((rep sums) 400)
+((sum 3000) 2147000000)
+(define step 2)
+(define walk (lambda n (lambda i (if (< 5000 i) n ((walk (+ n step)) (+ i 1))))))
+(define walks (lambda n ((walk 0) n)))
+((rep walks) 100)
+(define step 3)
+((rep walks) 100)
+(define zig (lambda n (lambda acc (if (= n 0) acc ((zig (- n 1)) (if (< acc 50) (+ acc 7) (- acc 60)))))))
+(define zigs (lambda n ((zig n) 0)))
+((rep zigs) 200)
+(define swap (lambda a (lambda b (lambda n (if (= n 0) (- a b) (((swap b) a) (- n 1)))))))
+(define swaps (lambda n (((swap n) 1) n)))
+((rep swaps) 100)
+(((swap 5) 1) 3001)
@@ -0,0 +1,11 @@
+(define g (lambda n (* (+ n 1) (+ (* (+ n 2) 3) (* (+ n 3) (+ (* n 5) (* (+ n 4) (+ (* n 7) (* (+ n 5) (+ n (* (+ n 6) (+ (* n 0) (+ (* 1 n) (* n n))))))))))))))
+(define h (lambda n (+ (* n n) (+ (* n n) (+ 0 (* 1 (+ n 7)))))))
+(define k (lambda n 42))
+(define i (lambda n n))
+(define s (lambda n (+ (+ (g n) (h n)) (+ (k n) (i n)))))
+(define run (lambda a (stream-ref (stream-iterate s a) 3000)))
+(run 1)
+(run 5)
+(s 3)
+(g 12345)
+(h 99999)
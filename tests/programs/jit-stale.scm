@@ -0,0 +1,7 @@
+(define k 2)
+(define g (lambda x (+ x k)))
+(define f (lambda c (g (- 1 c))))
+(define l (lambda n (lambda acc (if (< n 1) acc ((l (- n 1)) (+ acc (f n)))))))
+((l 300) 0)
+(define k 8)
+((l 300) 0)
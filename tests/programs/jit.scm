@@ -0,0 +1,11 @@
+(define inc (lambda n (+ n 1)))
+(define sq (lambda n (* n n)))
+(define twice (lambda g (lambda x (g (g x)))))
+(define f (lambda n (+ ((twice inc) (sq n)) (* 3 n))))
+(define walk (lambda k (stream-ref (stream-iterate f k) 2000)))
+(walk 1)
+(f 7)
+(define inc (lambda n (+ n 2)))
+(f 7)
+(walk 1)
+(f 7)
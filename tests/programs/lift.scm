@@ -0,0 +1,27 @@
+(define add (lambda x (lambda y (+ x y))))
+(define add3 (lambda a (lambda b (lambda c (+ a (* b c))))))
+(define f (lambda x ((add x) 7)))
+(f 5)
+f
+(define g (lambda x ((lambda y (+ x y)) 10)))
+(g 1)
+g
+(define h (lambda x ((lambda x (* x x)) (+ x 1))))
+(h 3)
+(define k (lambda x (((add3 x) 2) 3)))
+(k 1)
+(define k2 (lambda x ((add3 x) 2)))
+((k2 1) 3)
+(define over (lambda x (((lambda a (lambda b (+ a b))) x) x)))
+(over 4)
+(define sh (lambda x ((lambda x (lambda z (+ x z))) 1)))
+((sh 100) 5)
+(define poly (lambda x (+ (f x) (g x))))
+(poly 2)
+(define add (lambda x (lambda y (* x y))))
+(f 5)
+(poly 2)
+(normalize g)
+(define err (lambda x ((add x) (quote a))))
+(err 1)
+(time (f 3))
@@ -0,0 +1,5 @@
+(define loop (lambda n (if (< n 1) 0 (+ 1 (loop (- n 1))))))
+(time (loop 5000))
+(time (loop 5000))
+(define count (lambda n (if (= n 0) 0 (count (- n 1)))))
+(time (count 5000))
@@ -0,0 +1,10 @@
+(quote (f x))
+(define two (lambda f (lambda x (f (f x)))))
+(define four (lambda g (lambda y (g (g (g (g y)))))))
+(normalize (quote (two two)))
+(eq (normalize (quote (two two))) (normalize four))
+(eq (normalize (quote (two two))) (normalize two))
+(normalize (quote (lambda a ((lambda b (b a)) (lambda c c)))))
+(normalize (quote ((two two) h)))
+(eq 3 (+ 1 2))
+(normalize (quote ((lambda x (x x)) (lambda x (x x)))))
@@ -0,0 +1,12 @@
+(define g (lambda n ((lambda y 5) (* n 1000000))))
+(stream-ref (stream-iterate g 1) 1200)
+(g 3000)
+(g 2)
+(define z (lambda n (+ (* (* n 1000000) 0) (- n (* n 1)))))
+(stream-ref (stream-iterate z 1) 1200)
+(z 3000)
+(z 2)
+(define s (lambda n (if (< n 100) ((lambda y n) (+ n 2147483600)) 0)))
+(stream-ref (stream-iterate s 1) 1200)
+(s 99)
+(s 40)
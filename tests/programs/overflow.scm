@@ -0,0 +1,15 @@
+(define f (lambda n (+ (* n (* n n)) 1)))
+(define s1 (lambda k (f (+ (* k 0) 3))))
+(stream-ref (stream-iterate s1 1) 2000)
+(f 1290)
+(f 1291)
+(f 1000)
+(define h (lambda n (+ n 2000000000)))
+(define s2 (lambda k (h (+ (* k 0) 140000000))))
+(stream-ref (stream-iterate s2 1) 2000)
+(h 147483647)
+(h 147483648)
+(h 5)
+(define w (lambda n (* n 3)))
+(define s3 (lambda k (w (+ (* k 0) 1000000000))))
+(stream-ref (stream-iterate s3 1) 70)
@@ -0,0 +1,23 @@
+(define inc (lambda n (+ n 1)))
+(define sq (lambda n (* n n)))
+(define twice (lambda f (lambda x (f (f x)))))
+((twice inc) 5)
+((twice sq) 3)
+(define clamp (lambda x (if (< x 0) (sq x) (if (< 100 x) 100 (inc x)))))
+(define loop (lambda n (if (< n 1) 0 (+ (clamp n) (loop (- n 1))))))
+(loop 2000)
+(loop 2000)
+(clamp (- 0 5))
+(define each (lambda f (lambda n (if (< n 1) 0 (+ (f n) ((each f) (- n 1)))))))
+(define drive (lambda n ((each inc) n)))
+(define drive-all (lambda k (if (< k 1) 0 (+ (drive 30) (drive-all (- k 1))))))
+(drive-all 200)
+(drive-all 200)
+((each sq) 10)
+(define inc (lambda n (+ n 2)))
+(drive 10)
+((twice inc) 5)
+(define scale (lambda x (* x 1.5)))
+(define total (lambda n (if (< n 1) 0.0 (+ (scale n) (total (- n 1))))))
+(total 2000)
+(total 10)
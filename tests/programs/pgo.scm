@@ -0,0 +1,8 @@
+(define inc (lambda n (+ n 1)))
+(define sq (lambda n (* n n)))
+(define f (lambda n (+ (sq (inc n)) (inc n))))
+(define cold (lambda n (inc n)))
+(define twice (lambda g (lambda x (g (g x)))))
+(define loop (lambda n (stream-ref (stream-iterate f 0) 600)))
+(loop 0)
+((twice inc) 5)
@@ -0,0 +1,20 @@
+(+ 2 (* 3 4))
+(quote (a b))
+(define p (delay (time (* 6 7))))
+(force p)
+(force p)
+(define q (delay-force (delay-force (delay 5))))
+(force q)
+(cons 1 (cons 2 nil))
+(cdr (cons 1 2))
+(define add1 (lambda x (+ x 1)))
+(define nat (stream-iterate add1 0))
+(stream-take nat 5)
+(stream-ref nat 100000)
+(define s (stream-cons 1 (stream-cons 2 nil)))
+(stream-car (stream-cdr s))
+(stream-take s 2)
+(force 3)
+(eq (normalize (quote (lambda a a))) (normalize (quote (lambda b b))))
+(time (stream-ref (stream-iterate add1 0) 1000))
+(stream-take s 3)
@@ -0,0 +1,10 @@
+(define inc (lambda n (+ n 1)))
+(define sq (lambda n (* n n)))
+(define add (lambda a (lambda b (+ a b))))
+(define poly (lambda x (+ (* 3 (sq x)) (+ ((add x) 7) (inc x)))))
+(define two (lambda f (lambda x (f (f x)))))
+(define walk (lambda k (stream-ref (stream-iterate poly k) 3000)))
+(walk 1)
+(((two two) inc) 5)
+(define fib-step (lambda p (cons (cdr p) (+ (car p) (cdr p)))))
+(car (stream-ref (stream-iterate fib-step (cons 0 1)) 1000))
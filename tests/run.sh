@@ -0,0 +1,130 @@
+#!/bin/sh
+# Regression tests for scheme_repl.c.  Each program in tests/programs runs
+# under --no-jit, whose output must match the recorded NAME.out, and then
+# under every other execution mode, whose output must match --no-jit (or, for
+# --lazy, NAME.lazy.out where a program has one).  Those in tests/optimal run
+# under --optimal against their recorded output, and those in tests/aot are
+# compiled to C and must print what the interpreter prints.  Run with
+# --update to re-record the NAME.out files.
+set -u
+root=$(cd "$(dirname "$0")/.." && pwd)
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+cc=${CC:-cc}
+update=0
+[ "${1:-}" = "--update" ] && update=1
+failures=0
+checks=0
+
+$cc -O2 -Wall -Wextra -o "$tmp/scheme_repl" "$root/scheme_repl.c" || exit 1
+repl="$tmp/scheme_repl"
+
+# Timings and allocation counts change from run to run and between modes,
+# and the compiled program prints no prompts
+normalize() {
+    sed -e 's/; wall .*/; wall/' -e 's/^\(> \)*//' -e 's/^>$//' -e '/^$/d'
+}
+
+run() {
+    "$repl" "$@" 2>&1 | normalize
+}
+
+# check NAME EXPECTED ACTUAL
+check() {
+    checks=$((checks + 1))
+    if ! cmp -s "$2" "$3"; then
+        echo "FAIL: $1"
+        diff "$2" "$3" | head -20
+        failures=$((failures + 1))
+    fi
+}
+
+for program in "$root"/tests/programs/*.scm; do
+    [ -f "$program" ] || continue
+    name=$(basename "$program" .scm)
+    run --no-jit < "$program" > "$tmp/reference"
+    if [ $update -eq 1 ]; then
+        cp "$tmp/reference" "${program%.scm}.out"
+    else
+        check "$name --no-jit" "${program%.scm}.out" "$tmp/reference"
+    fi
+    for mode in "" --no-inline --no-lift; do
+        run $mode < "$program" > "$tmp/actual"
+        check "$name ${mode:-(default)}" "$tmp/reference" "$tmp/actual"
+    done
+    # --lazy never forces an argument that goes unused, so a program that
+    # relies on one being evaluated records what it prints in NAME.lazy.out
+    lazy=${program%.scm}.lazy.out
+    run --lazy < "$program" > "$tmp/actual"
+    if [ ! -f "$lazy" ]; then
+        check "$name --lazy" "$tmp/reference" "$tmp/actual"
+    elif [ $update -eq 1 ]; then
+        cp "$tmp/actual" "$lazy"
+    else
+        check "$name --lazy" "$lazy" "$tmp/actual"
+    fi
+    # The second profiled run compiles with the counts of the first
+    rm -f "$tmp/profile"
+    for pass in record replay; do
+        run --profile "$tmp/profile" < "$program" > "$tmp/actual"
+        check "$name --profile ($pass)" "$tmp/reference" "$tmp/actual"
+    done
+done
+
+# --optimal prints normal forms where eval prints closures, so its programs
+# only have recorded output.  Every complete reduction of a net takes the
+# same number of interactions, so several workers must print the same.
+for program in "$root"/tests/optimal/*.scm; do
+    name=optimal/$(basename "$program" .scm)
+    run --optimal < "$program" > "$tmp/actual"
+    if [ $update -eq 1 ]; then
+        cp "$tmp/actual" "${program%.scm}.out"
+    else
+        check "$name" "${program%.scm}.out" "$tmp/actual"
+    fi
+    run --optimal --net-threads 4 < "$program" > "$tmp/threaded"
+    check "$name --net-threads 4" "$tmp/actual" "$tmp/threaded"
+done
+
+for program in "$root"/tests/aot/*.scm; do
+    name=aot/$(basename "$program" .scm)
+    run --no-jit < "$program" > "$tmp/reference"
+    if "$repl" --compile-to-c "$tmp/aot.c" < "$program" > /dev/null &&
+       $cc -O2 -Wall -Wextra -Werror -o "$tmp/aot" "$tmp/aot.c" -lm; then
+        "$tmp/aot" 2>&1 | normalize > "$tmp/actual"
+    else
+        echo "compilation failed" > "$tmp/actual"
+    fi
+    check "$name" "$tmp/reference" "$tmp/actual"
+done
+
+# A memoized result persisted with --memo-store is only served to a later
+# run while the definition, including bindings its closures captured, is the
+# same
+rm -f "$tmp/store"
+for a in 5 7 5; do
+    printf '(define k ((lambda a (lambda b (+ a b))) %s))\n(define m (memoize (lambda n (k n))))\n(m 1)\n' $a |
+        run --memo-store "$tmp/store" | tail -n 1
+done > "$tmp/actual"
+printf '6\n8\n6\n' > "$tmp/reference"
+check "memo store keyed on captured bindings" "$tmp/reference" "$tmp/actual"
+
+# The same holds for globals defined or redefined after memoize
+rm -f "$tmp/store"
+for program in \
+    '(define k 1)\n(define m (memoize (lambda n (+ n k))))\n(m 1)\n(define k 5)\n(m 3)\n' \
+    '(define k 1)\n(define m (memoize (lambda n (+ n k))))\n(m 3)\n' \
+    '(define m (memoize (lambda n (+ n j))))\n(define j 10)\n(m 1)\n' \
+    '(define m (memoize (lambda n (+ n j))))\n(define j 20)\n(m 1)\n'; do
+    printf "$program" | run --memo-store "$tmp/store" | tail -n 1
+done > "$tmp/actual"
+printf '8\n4\n11\n21\n' > "$tmp/reference"
+check "memo store rehashed on redefinition" "$tmp/reference" "$tmp/actual"
+
+# An empty parser corpus has no per-node figures to divide out
+"$repl" --bench-parser --corpus-bytes 0 | grep -c nan > "$tmp/actual"
+echo 0 > "$tmp/reference"
+check "bench-parser on an empty corpus" "$tmp/reference" "$tmp/actual"
+
+echo "$((checks - failures))/$checks checks passed"
+[ $failures -eq 0 ]